@@ -0,0 +1,137 @@
+/*
+ * Timing driver for the string kernels against naive byte loops.
+ *
+ * Not part of the interpreter build. From the repository root:
+ *
+ *     g++ -std=c++17 -O2 -DFMT_HEADER_ONLY -Isrc/include \
+ *         bench/strkernels_bench.cpp src/stdlib/strkernels.cpp -o strkernels_bench
+ *     ./strkernels_bench
+ *
+ * The kernels run with the set selected for this CPU; ELY_KERNELS=sse2 or
+ * ELY_KERNELS=scalar forces another one.
+*/
+
+#include "provider/strkernels.h"
+
+#include <chrono>
+#include <string>
+#include <string_view>
+
+using namespace stdlib;
+
+/* Naive loops, one byte at a time. */
+
+static size_t naive_find(std::string_view haystack, std::string_view needle)
+{
+    if (needle.size() > haystack.size())
+        return std::string_view::npos;
+    for (size_t i = 0; i + needle.size() <= haystack.size(); ++i) {
+        size_t k = 0;
+        while (k < needle.size() && haystack[i + k] == needle[k])
+            ++k;
+        if (k == needle.size())
+            return i;
+    }
+    return std::string_view::npos;
+}
+
+static size_t naive_count(std::string_view haystack, std::string_view needle)
+{
+    size_t count = 0;
+    for (size_t i = 0; i + needle.size() <= haystack.size();) {
+        size_t k = 0;
+        while (k < needle.size() && haystack[i + k] == needle[k])
+            ++k;
+        if (k == needle.size()) {
+            ++count;
+            i += needle.size();
+        } else {
+            ++i;
+        }
+    }
+    return count;
+}
+
+static void naive_to_upper(char* data, size_t length)
+{
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] >= 'a' && data[i] <= 'z')
+            data[i] = static_cast<char>(data[i] - 'a' + 'A');
+    }
+}
+
+static size_t naive_code_points(std::string_view text)
+{
+    size_t count = 0;
+    for (char byte : text)
+        count += (static_cast<unsigned char>(byte) & 0xC0) != 0x80;
+    return count;
+}
+
+/**
+ * @brief Keep a result alive so the timed call is not optimized away.
+*/
+static volatile size_t sink;
+
+/**
+ * @brief Nanoseconds per call of func, repeated for about 0.2s.
+*/
+template <typename Fn>
+static double time_per_call(Fn&& func)
+{
+    using Clock = std::chrono::steady_clock;
+    size_t calls = 1;
+    while (true) {
+        const auto start = Clock::now();
+        for (size_t i = 0; i < calls; ++i)
+            sink = sink + func();
+        const double elapsed = std::chrono::duration<double, std::nano>(Clock::now() - start).count();
+        if (elapsed > 2e8)
+            return elapsed / static_cast<double>(calls);
+        calls *= 2;
+    }
+}
+
+static void report(const char* name, size_t bytes, double kernel_ns, double naive_ns)
+{
+    fmt::print("{:<22s} {:>9} B  kernel {:>11.1f} ns  naive {:>11.1f} ns  x{:.1f}\n",
+               name, bytes, kernel_ns, naive_ns, naive_ns / kernel_ns);
+}
+
+int main()
+{
+    fmt::print("kernels: {}\n", kernels::instruction_set());
+
+    // Log-like text: the needles below never occur, so searches scan it all.
+    std::string line = "2024-01-01 12:00:00 INFO request handled in 12ms path=/api/items\n";
+    for (size_t length : { size_t(16), size_t(64), size_t(1) << 20 }) {
+        std::string text;
+        while (text.size() < length)
+            text += line;
+        text.resize(length);
+        std::string copy = text;
+
+        report("find (1 byte)", length,
+            time_per_call([&] { return kernels::find(text, "#"); }),
+            time_per_call([&] { return naive_find(text, "#"); }));
+        report("find (8 bytes)", length,
+            time_per_call([&] { return kernels::find(text, "ERROR id"); }),
+            time_per_call([&] { return naive_find(text, "ERROR id"); }));
+        report("find (common start)", length,
+            time_per_call([&] { return kernels::find(text, "path=/api/users"); }),
+            time_per_call([&] { return naive_find(text, "path=/api/users"); }));
+        report("count (newline)", length,
+            time_per_call([&] { return kernels::count(text, "\n"); }),
+            time_per_call([&] { return naive_count(text, "\n"); }));
+        report("count (word)", length,
+            time_per_call([&] { return kernels::count(text, "INFO"); }),
+            time_per_call([&] { return naive_count(text, "INFO"); }));
+        report("toUpper", length,
+            time_per_call([&] { kernels::to_upper(copy.data(), copy.size()); return copy.size(); }),
+            time_per_call([&] { naive_to_upper(copy.data(), copy.size()); return copy.size(); }));
+        report("code points", length,
+            time_per_call([&] { return kernels::count_code_points(text); }),
+            time_per_call([&] { return naive_code_points(text); }));
+    }
+    return 0;
+}
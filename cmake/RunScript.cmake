@@ -0,0 +1,15 @@
+# Runs SCRIPT with INTERPRETER and compares everything it prints with the
+# .out file next to the script.
+
+execute_process(
+    COMMAND "${INTERPRETER}" "${SCRIPT}"
+    OUTPUT_VARIABLE output
+    ERROR_VARIABLE output
+)
+
+string(REGEX REPLACE "\\.ely$" ".out" expected_file "${SCRIPT}")
+file(READ "${expected_file}" expected)
+
+if (NOT output STREQUAL expected)
+    message(FATAL_ERROR "Output of ${SCRIPT} differs from ${expected_file}:\n${output}")
+endif()
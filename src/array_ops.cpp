@@ -0,0 +1,408 @@
+#include "runtime/array_ops.h"
+#include "runtime/typed_array.h"
+
+#include <cmath>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #define ELY_ARRAY_SSE2
+    #include <emmintrin.h>
+#endif
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define ELY_ARRAY_AVX
+    #include <immintrin.h>
+#endif
+
+/*
+ * Kernels work on doubles: a number operand is a one element buffer
+ * broadcast over the other operand. Comparisons give 1.0 or 0.0.
+ */
+
+struct AddKernel {
+    static inline double scalar(double a, double b) { return a + b; }
+#ifdef ELY_ARRAY_SSE2
+    static inline __m128d sse2(__m128d a, __m128d b) { return _mm_add_pd(a, b); }
+#endif
+#ifdef ELY_ARRAY_AVX
+    __attribute__((target("avx"))) static inline __m256d avx(__m256d a, __m256d b) { return _mm256_add_pd(a, b); }
+#endif
+};
+
+struct SubtractKernel {
+    static inline double scalar(double a, double b) { return a - b; }
+#ifdef ELY_ARRAY_SSE2
+    static inline __m128d sse2(__m128d a, __m128d b) { return _mm_sub_pd(a, b); }
+#endif
+#ifdef ELY_ARRAY_AVX
+    __attribute__((target("avx"))) static inline __m256d avx(__m256d a, __m256d b) { return _mm256_sub_pd(a, b); }
+#endif
+};
+
+struct MultiplyKernel {
+    static inline double scalar(double a, double b) { return a * b; }
+#ifdef ELY_ARRAY_SSE2
+    static inline __m128d sse2(__m128d a, __m128d b) { return _mm_mul_pd(a, b); }
+#endif
+#ifdef ELY_ARRAY_AVX
+    __attribute__((target("avx"))) static inline __m256d avx(__m256d a, __m256d b) { return _mm256_mul_pd(a, b); }
+#endif
+};
+
+struct DivideKernel {
+    static inline double scalar(double a, double b) { return a / b; }
+#ifdef ELY_ARRAY_SSE2
+    static inline __m128d sse2(__m128d a, __m128d b) { return _mm_div_pd(a, b); }
+#endif
+#ifdef ELY_ARRAY_AVX
+    __attribute__((target("avx"))) static inline __m256d avx(__m256d a, __m256d b) { return _mm256_div_pd(a, b); }
+#endif
+};
+
+struct GreaterKernel {
+    static inline double scalar(double a, double b) { return a > b ? 1.0 : 0.0; }
+#ifdef ELY_ARRAY_SSE2
+    static inline __m128d sse2(__m128d a, __m128d b) { return _mm_and_pd(_mm_cmpgt_pd(a, b), _mm_set1_pd(1.0)); }
+#endif
+#ifdef ELY_ARRAY_AVX
+    __attribute__((target("avx"))) static inline __m256d avx(__m256d a, __m256d b)
+    {
+        return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_GT_OQ), _mm256_set1_pd(1.0));
+    }
+#endif
+};
+
+struct LessKernel {
+    static inline double scalar(double a, double b) { return a < b ? 1.0 : 0.0; }
+#ifdef ELY_ARRAY_SSE2
+    static inline __m128d sse2(__m128d a, __m128d b) { return _mm_and_pd(_mm_cmplt_pd(a, b), _mm_set1_pd(1.0)); }
+#endif
+#ifdef ELY_ARRAY_AVX
+    __attribute__((target("avx"))) static inline __m256d avx(__m256d a, __m256d b)
+    {
+        return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_LT_OQ), _mm256_set1_pd(1.0));
+    }
+#endif
+};
+
+struct GreaterEqualKernel {
+    static inline double scalar(double a, double b) { return a >= b ? 1.0 : 0.0; }
+#ifdef ELY_ARRAY_SSE2
+    static inline __m128d sse2(__m128d a, __m128d b) { return _mm_and_pd(_mm_cmpge_pd(a, b), _mm_set1_pd(1.0)); }
+#endif
+#ifdef ELY_ARRAY_AVX
+    __attribute__((target("avx"))) static inline __m256d avx(__m256d a, __m256d b)
+    {
+        return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_GE_OQ), _mm256_set1_pd(1.0));
+    }
+#endif
+};
+
+struct LessEqualKernel {
+    static inline double scalar(double a, double b) { return a <= b ? 1.0 : 0.0; }
+#ifdef ELY_ARRAY_SSE2
+    static inline __m128d sse2(__m128d a, __m128d b) { return _mm_and_pd(_mm_cmple_pd(a, b), _mm_set1_pd(1.0)); }
+#endif
+#ifdef ELY_ARRAY_AVX
+    __attribute__((target("avx"))) static inline __m256d avx(__m256d a, __m256d b)
+    {
+        return _mm256_and_pd(_mm256_cmp_pd(a, b, _CMP_LE_OQ), _mm256_set1_pd(1.0));
+    }
+#endif
+};
+
+template <typename Kernel>
+static void run_scalar(const double* a, bool a_scalar, const double* b, bool b_scalar,
+                       double* out, size_t length, size_t from = 0)
+{
+    for (size_t i = from; i < length; ++i)
+        out[i] = Kernel::scalar(a[a_scalar ? 0 : i], b[b_scalar ? 0 : i]);
+}
+
+#ifdef ELY_ARRAY_SSE2
+template <typename Kernel>
+static void run_sse2(const double* a, bool a_scalar, const double* b, bool b_scalar,
+                     double* out, size_t length)
+{
+    const __m128d a_fill = a_scalar ? _mm_set1_pd(a[0]) : _mm_setzero_pd();
+    const __m128d b_fill = b_scalar ? _mm_set1_pd(b[0]) : _mm_setzero_pd();
+
+    size_t i = 0;
+    for (; i + 2 <= length; i += 2) {
+        const __m128d left = a_scalar ? a_fill : _mm_loadu_pd(a + i);
+        const __m128d right = b_scalar ? b_fill : _mm_loadu_pd(b + i);
+        _mm_storeu_pd(out + i, Kernel::sse2(left, right));
+    }
+    run_scalar<Kernel>(a, a_scalar, b, b_scalar, out, length, i);
+}
+#endif
+
+#ifdef ELY_ARRAY_AVX
+template <typename Kernel>
+__attribute__((target("avx")))
+static void run_avx(const double* a, bool a_scalar, const double* b, bool b_scalar,
+                    double* out, size_t length)
+{
+    const __m256d a_fill = a_scalar ? _mm256_set1_pd(a[0]) : _mm256_setzero_pd();
+    const __m256d b_fill = b_scalar ? _mm256_set1_pd(b[0]) : _mm256_setzero_pd();
+
+    size_t i = 0;
+    for (; i + 4 <= length; i += 4) {
+        const __m256d left = a_scalar ? a_fill : _mm256_loadu_pd(a + i);
+        const __m256d right = b_scalar ? b_fill : _mm256_loadu_pd(b + i);
+        _mm256_storeu_pd(out + i, Kernel::avx(left, right));
+    }
+    run_scalar<Kernel>(a, a_scalar, b, b_scalar, out, length, i);
+}
+
+static bool has_avx()
+{
+    static const bool supported = __builtin_cpu_supports("avx");
+    return supported;
+}
+#endif
+
+/*
+ * Reductions keep one accumulator per vector lane and fold the lanes at
+ * the end, so the sum is not added in index order.
+ */
+
+template <typename Reduce>
+static double reduce_scalar(const double* data, size_t size, double accumulator, size_t from = 0)
+{
+    for (size_t i = from; i < size; ++i)
+        accumulator = Reduce::scalar(accumulator, data[i]);
+    return accumulator;
+}
+
+#ifdef ELY_ARRAY_SSE2
+template <typename Reduce>
+static double reduce_sse2(const double* data, size_t size, double initial)
+{
+    __m128d accumulator = _mm_set1_pd(initial);
+    size_t i = 0;
+    for (; i + 2 <= size; i += 2)
+        accumulator = Reduce::sse2(accumulator, _mm_loadu_pd(data + i));
+
+    double lanes[2];
+    _mm_storeu_pd(lanes, accumulator);
+    return reduce_scalar<Reduce>(data, size, Reduce::scalar(lanes[0], lanes[1]), i);
+}
+#endif
+
+#ifdef ELY_ARRAY_AVX
+template <typename Reduce>
+__attribute__((target("avx")))
+static double reduce_avx(const double* data, size_t size, double initial)
+{
+    __m256d accumulator = _mm256_set1_pd(initial);
+    size_t i = 0;
+    for (; i + 4 <= size; i += 4)
+        accumulator = Reduce::avx(accumulator, _mm256_loadu_pd(data + i));
+
+    double lanes[4];
+    _mm256_storeu_pd(lanes, accumulator);
+    const double folded = Reduce::scalar(Reduce::scalar(lanes[0], lanes[1]), Reduce::scalar(lanes[2], lanes[3]));
+    return reduce_scalar<Reduce>(data, size, folded, i);
+}
+#endif
+
+/**
+ * @brief Reduce a range; the initial value must be neutral for the operation
+ * since every lane starts from it.
+*/
+template <typename Reduce>
+static double reduce(const double* data, size_t size, double initial)
+{
+#ifdef ELY_ARRAY_AVX
+    if (has_avx())
+        return reduce_avx<Reduce>(data, size, initial);
+#endif
+#ifdef ELY_ARRAY_SSE2
+    return reduce_sse2<Reduce>(data, size, initial);
+#else
+    return reduce_scalar<Reduce>(data, size, initial);
+#endif
+}
+
+struct MinKernel {
+    static inline double scalar(double a, double b) { return b < a ? b : a; }
+#ifdef ELY_ARRAY_SSE2
+    static inline __m128d sse2(__m128d a, __m128d b) { return _mm_min_pd(a, b); }
+#endif
+#ifdef ELY_ARRAY_AVX
+    __attribute__((target("avx"))) static inline __m256d avx(__m256d a, __m256d b) { return _mm256_min_pd(a, b); }
+#endif
+};
+
+struct MaxKernel {
+    static inline double scalar(double a, double b) { return b > a ? b : a; }
+#ifdef ELY_ARRAY_SSE2
+    static inline __m128d sse2(__m128d a, __m128d b) { return _mm_max_pd(a, b); }
+#endif
+#ifdef ELY_ARRAY_AVX
+    __attribute__((target("avx"))) static inline __m256d avx(__m256d a, __m256d b) { return _mm256_max_pd(a, b); }
+#endif
+};
+
+double sum(const double* data, size_t size)
+{
+    return reduce<AddKernel>(data, size, 0.0);
+}
+
+double minimum(const double* data, size_t size)
+{
+    return reduce<MinKernel>(data, size, data[0]);
+}
+
+double maximum(const double* data, size_t size)
+{
+    return reduce<MaxKernel>(data, size, data[0]);
+}
+
+template <typename Kernel>
+static void run(const double* a, bool a_scalar, const double* b, bool b_scalar, double* out, size_t length)
+{
+#ifdef ELY_ARRAY_AVX
+    if (has_avx())
+        return run_avx<Kernel>(a, a_scalar, b, b_scalar, out, length);
+#endif
+#ifdef ELY_ARRAY_SSE2
+    run_sse2<Kernel>(a, a_scalar, b, b_scalar, out, length);
+#else
+    run_scalar<Kernel>(a, a_scalar, b, b_scalar, out, length);
+#endif
+}
+
+const char* view_numbers(const Value& value, NumericView& view)
+{
+    if (const double* number = std::get_if<double>(&value)) {
+        view.data = number;
+        view.size = 1;
+        view.scalar = true;
+    } else if (const TypedArray* typed = std::get_if<TypedArray>(&value)) {
+        view.typed = typed->get();
+        view.size = (*typed)->size();
+        if (const auto* f64 = std::get_if<std::vector<double>>(&(*typed)->elements)) {
+            view.data = f64->data();
+        } else {
+            std::visit([&view](const auto& values) {
+                view.buffer.assign(values.begin(), values.end());
+            }, (*typed)->elements);
+            view.data = view.buffer.data();
+        }
+    } else if (const Array* array = std::get_if<Array>(&value)) {
+        view.buffer.reserve((*array)->size());
+        for (const Value& item : **array) {
+            const double* number = std::get_if<double>(&item);
+            if (number == nullptr)
+                return "Array operands must only contain numbers.";
+            view.buffer.push_back(*number);
+        }
+        view.data = view.buffer.data();
+        view.size = view.buffer.size();
+    } else {
+        return "Operands must be numbers or arrays.";
+    }
+    return nullptr;
+}
+
+static ElementKind result_kind(ArrayOp op, const NumericView& a, const NumericView& b)
+{
+    const ElementKind kind = (a.typed ? a.typed : b.typed)->kind();
+    if (kind == ElementKind::F64 || op == ArrayOp::Divide)
+        return ElementKind::F64;
+
+    for (const NumericView* operand : { &a, &b }) {
+        if (operand->typed) {
+            if (operand->typed->kind() != kind)
+                return ElementKind::F64;
+        } else if (!operand->scalar || std::trunc(operand->data[0]) != operand->data[0]) {
+            return ElementKind::F64;
+        }
+    }
+    return kind;
+}
+
+bool is_array_operand(const Value& value)
+{
+    return std::holds_alternative<Array>(value) || std::holds_alternative<TypedArray>(value);
+}
+
+const char* elementwise(ArrayOp op, const Value& a, const Value& b, Value& result)
+{
+    NumericView left, right;
+    if (const char* error = view_numbers(a, left))
+        return error;
+    if (const char* error = view_numbers(b, right))
+        return error;
+    if (!left.scalar && !right.scalar && left.size != right.size)
+        return "Array operands must have the same length.";
+
+    const size_t length = left.scalar ? right.size : left.size;
+    const bool comparison = op == ArrayOp::Greater || op == ArrayOp::Less
+                         || op == ArrayOp::GreaterEqual || op == ArrayOp::LessEqual;
+
+    // f64 results are computed straight into the new array.
+    std::vector<double> buffer;
+    TypedArray typed;
+    double* out;
+    if (left.typed || right.typed) {
+        const ElementKind kind = comparison ? ElementKind::U8 : result_kind(op, left, right);
+        typed = std::make_shared<TypedArrayObj>(kind, length);
+        if (kind == ElementKind::F64) {
+            out = std::get<std::vector<double>>(typed->elements).data();
+        } else {
+            buffer.resize(length);
+            out = buffer.data();
+        }
+    } else {
+        buffer.resize(length);
+        out = buffer.data();
+    }
+
+    // Empty operands have no data to read, the result is just empty.
+    if (length == 0) {
+        if (typed)
+            result = typed;
+        else
+            result = std::make_shared<ArrayObj>(ArrayObj::Storage());
+        return nullptr;
+    }
+
+    switch (op) {
+        case ArrayOp::Add:      run<AddKernel>(left.data, left.scalar, right.data, right.scalar, out, length); break;
+        case ArrayOp::Subtract: run<SubtractKernel>(left.data, left.scalar, right.data, right.scalar, out, length); break;
+        case ArrayOp::Multiply: run<MultiplyKernel>(left.data, left.scalar, right.data, right.scalar, out, length); break;
+        case ArrayOp::Divide:   run<DivideKernel>(left.data, left.scalar, right.data, right.scalar, out, length); break;
+        case ArrayOp::Greater:  run<GreaterKernel>(left.data, left.scalar, right.data, right.scalar, out, length); break;
+        case ArrayOp::Less:     run<LessKernel>(left.data, left.scalar, right.data, right.scalar, out, length); break;
+        case ArrayOp::GreaterEqual:
+            run<GreaterEqualKernel>(left.data, left.scalar, right.data, right.scalar, out, length);
+            break;
+        case ArrayOp::LessEqual:
+            run<LessEqualKernel>(left.data, left.scalar, right.data, right.scalar, out, length);
+            break;
+    }
+
+    if (typed) {
+        if (!buffer.empty()) {
+            std::visit([&buffer](auto& values) {
+                using T = typename std::decay_t<decltype(values)>::value_type;
+                for (size_t i = 0; i < values.size(); ++i)
+                    values[i] = TypedArrayObj::convert<T>(buffer[i]);
+            }, typed->elements);
+        }
+        result = typed;
+        return nullptr;
+    }
+
+    ArrayObj::Storage values;
+    values.reserve(length);
+    for (double value : buffer) {
+        if (comparison)
+            values.push_back(value != 0.0);
+        else
+            values.push_back(value);
+    }
+    result = std::make_shared<ArrayObj>(std::move(values));
+    return nullptr;
+}
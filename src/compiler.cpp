@@ -1,6 +1,11 @@
 #include "runtime/compiler.h"
+#include "runtime/map.h"
 
 #include <array>
+#include <algorithm>
+#include <climits>
+#include <cmath>
+#include <utility>
 
 Compiler::Compiler(Parser* parser, FunctionType type, std::unique_ptr<Compiler> enclosing)
     : parser(parser), type(type), function{default_function}, enclosing(std::move(enclosing))
@@ -22,22 +27,40 @@ void Compiler::add_local(const std::string& name)
 
 void Compiler::declare_variable(const std::string& name)
 {
+    check_redeclaration(name);
     if (scope_depth == 0) return;
     
+    add_local(name);
+}
+
+void Compiler::check_redeclaration(const std::string& name)
+{
+    if (scope_depth == 0) {
+        if (parser->constants.count(name) != 0) {
+            parser->error("Already a constant with this name.");
+        }
+        return;
+    }
+    
     for (auto i = static_cast<long long>(locals.size() - 1); i >= 0; i--) {
         if (locals[i].depth != -1 && locals[i].depth < scope_depth) break;
         if (locals[i].name == name) {
             parser->error("Already a variable with this name in this scope.");
         }
     }
-    
-    add_local(name);
+    for (const ConstVar& constant : constants) {
+        if (constant.depth == scope_depth && constant.name == name) {
+            parser->error("Already a variable with this name in this scope.");
+        }
+    }
 }
 
-void Compiler::mark_initialized()
+void Compiler::mark_initialized(size_t count)
 {
     if (scope_depth == 0) return;
-    locals.back().depth = scope_depth;
+    for (size_t i = locals.size() - count; i < locals.size(); ++i) {
+        locals[i].depth = scope_depth;
+    }
 }
 
 int Compiler::resolve_local(const std::string_view& name)
@@ -70,6 +93,27 @@ int Compiler::resolve_upvalue(const std::string& name)
     return -1;
 }
 
+const Value* Compiler::resolve_constant(std::string_view name) const
+{
+    auto named = [name](const auto& variable) { return variable.name == name; };
+    auto local = std::find_if(locals.rbegin(), locals.rend(), named);
+    auto constant = std::find_if(constants.rbegin(), constants.rend(), named);
+
+    // The innermost declaration wins, a local still in its initializer hides too.
+    if (constant != constants.rend()) {
+        if (local == locals.rend() || (local->depth != -1 && local->depth < constant->depth)) {
+            return &constant->value;
+        }
+        return nullptr;
+    }
+    if (local != locals.rend()) return nullptr;
+
+    if (enclosing != nullptr) return enclosing->resolve_constant(name);
+
+    auto global = parser->constants.find(std::string(name));
+    return global != parser->constants.end() ? &global->second : nullptr;
+}
+
 int Compiler::add_upvalue(uint8_t index, bool is_local)
 {
     for (long i = 0; i < static_cast<long>(upvalues.size()); i++) {
@@ -89,6 +133,24 @@ int Compiler::add_upvalue(uint8_t index, bool is_local)
     return upvalue_count - 1;
 }
 
+void Compiler::mark_upvalue_assigned(int index)
+{
+    const UpvalueVar& upvalue = upvalues[index];
+    if (upvalue.is_local) {
+        enclosing->locals[upvalue.index].is_assigned = true;
+    } else {
+        enclosing->mark_upvalue_assigned(upvalue.index);
+    }
+}
+
+void Compiler::resolve_captures(const LocalVar& local)
+{
+    const CaptureKind kind = local.is_assigned ? CaptureKind::Boxed : CaptureKind::Value;
+    for (int site : local.capture_sites) {
+        function->get_chunk().set_code(site, static_cast<uint8_t>(kind));
+    }
+}
+
 void Compiler::begin_scope()
 {
     scope_depth++;
@@ -98,13 +160,18 @@ void Compiler::end_scope()
 {
     scope_depth--;
     while (!locals.empty() && locals.back().depth > scope_depth) {
-        if (locals.back().is_captured) {
+        const LocalVar& local = locals.back();
+        if (local.is_captured && local.is_assigned) {
             parser->emit(Opcode::CloseUpvalue);
         } else {
             parser->emit(Opcode::Pop);
         }
+        resolve_captures(local);
         locals.pop_back();
     }
+    while (!constants.empty() && constants.back().depth > scope_depth) {
+        constants.pop_back();
+    }
 }
 
 bool Compiler::is_local() const
@@ -115,11 +182,16 @@ bool Compiler::is_local() const
 ClassCompiler::ClassCompiler(std::unique_ptr<ClassCompiler> enclosing)
     : enclosing(std::move(enclosing)), has_superclass{superclass_default} {};
 
-Parser::Parser(const std::string& source) :
+Parser::Parser(const std::string& source,
+               std::unordered_map<std::string, Value> constants,
+               LibraryConstants library_constants,
+               int line) :
     previous(Token(TokenType::Eof, source, 0)),
     current(Token(TokenType::Eof, source, 0)),
-    scanner(Tokenizer(source)),
+    scanner(Tokenizer(source, line)),
     class_compiler{nullptr},
+    constants(std::move(constants)),
+    library_constants(std::move(library_constants)),
     had_error{false}, panic_mode{false}
 {
     compiler = std::make_unique<Compiler>(this, FunctionType::Script, nullptr);
@@ -130,10 +202,17 @@ Parser::Parser(const std::string& source) :
 
 std::optional<Func> Parser::compile()
 {
+    if (lazy_functions) lazy_scope = std::make_shared<LazyScope>();
+
     while (!match(TokenType::Eof)) {
         declaration();
     }
     Func function = end_compiler();
+
+    if (lazy_scope != nullptr) {
+        lazy_scope->struct_types = struct_types;
+        lazy_scope->inline_methods = inline_methods;
+    }
     
     if (had_error) {
         return std::nullopt;
@@ -229,6 +308,9 @@ void Parser::emit_return()
 
 uint8_t Parser::make_constant(const Value& value)
 {
+    if (std::optional<size_t> existing = current_chunk().find_constant(value))
+        return static_cast<uint8_t>(*existing);
+
     size_t constant = current_chunk().add_constant(value);
     if (constant > UINT8_MAX) {
         error("Too many constants in one chunk.");
@@ -240,7 +322,146 @@ uint8_t Parser::make_constant(const Value& value)
 
 void Parser::emit_constant(const Value& value)
 {
+    const int start = current_chunk().count();
     emit(Opcode::Constant, make_constant(value));
+
+    if (std::holds_alternative<double>(value) || std::holds_alternative<std::string>(value)) {
+        compiler->constant_loads.push_back({ start, current_chunk().count(), value });
+    }
+}
+
+void Parser::emit_value(const Value& value)
+{
+    const int start = current_chunk().count();
+    if (const bool* boolean = std::get_if<bool>(&value)) {
+        emit(*boolean ? Opcode::True : Opcode::False);
+    } else if (std::holds_alternative<std::monostate>(value)) {
+        emit(Opcode::Nop);
+    } else {
+        emit_constant(value);
+        return;
+    }
+    compiler->constant_loads.push_back({ start, current_chunk().count(), value });
+}
+
+/**
+ * @brief Binary operation of a compound assignment token.
+*/
+static std::optional<Opcode> compound_operator(TokenType type)
+{
+    switch (type) {
+        case TokenType::PlusEqual:           return Opcode::Add;
+        case TokenType::MinusEqual:          return Opcode::Subtract;
+        case TokenType::StarEqual:           return Opcode::Multiply;
+        case TokenType::SlashEqual:          return Opcode::Divide;
+        case TokenType::BwAndEqual:          return Opcode::BwAnd;
+        case TokenType::BwOrEqual:           return Opcode::BwOr;
+        case TokenType::BwXorEqual:          return Opcode::BwXor;
+        case TokenType::LessLessEqual:       return Opcode::ShiftLeft;
+        case TokenType::GreaterGreaterEqual: return Opcode::ShiftRight;
+        default:                             return std::nullopt;
+    }
+}
+
+/**
+ * @brief Result of a binary operator on known operands, nothing when the
+ * virtual machine would not give a plain value (errors, array operations).
+*/
+static std::optional<Value> fold_binary_values(TokenType operator_type, const Value& a, const Value& b)
+{
+    switch (operator_type) {
+        case TokenType::EqualEqual: return Value(values_equal(a, b));
+        case TokenType::ExclEqual:  return Value(!values_equal(a, b));
+        default: break;
+    }
+
+    const std::string* str_a = std::get_if<std::string>(&a);
+    const std::string* str_b = std::get_if<std::string>(&b);
+    if (str_a != nullptr && str_b != nullptr) {
+        if (operator_type == TokenType::Plus) return Value(*str_a + *str_b);
+        return std::nullopt;
+    }
+
+    const double* num_a = std::get_if<double>(&a);
+    const double* num_b = std::get_if<double>(&b);
+    if (num_a == nullptr || num_b == nullptr) return std::nullopt;
+
+    const double x = *num_a;
+    const double y = *num_b;
+    auto fits_int = [](double d) { return d > INT_MIN - 1.0 && d < INT_MAX + 1.0; };
+    switch (operator_type) {
+        case TokenType::Plus:         return Value(x + y);
+        case TokenType::Minus:        return Value(x - y);
+        case TokenType::Star:         return Value(x * y);
+        case TokenType::Slash:        return Value(x / y);
+        case TokenType::Greater:      return Value(x > y);
+        case TokenType::Less:         return Value(x < y);
+        case TokenType::GreaterEqual: return Value(x >= y);
+        case TokenType::LessEqual:    return Value(x <= y);
+        default: break;
+    }
+
+    if (!fits_int(x) || !fits_int(y)) return std::nullopt;
+    switch (operator_type) {
+        case TokenType::BwAnd: return Value(static_cast<double>(static_cast<int>(x) & static_cast<int>(y)));
+        case TokenType::BwOr:  return Value(static_cast<double>(static_cast<int>(x) | static_cast<int>(y)));
+        case TokenType::BwXor: return Value(static_cast<double>(static_cast<int>(x) ^ static_cast<int>(y)));
+        default:               return std::nullopt;
+    }
+}
+
+bool Parser::fold_binary(TokenType operator_type, int right_start)
+{
+    std::vector<ConstantLoad>& loads = compiler->constant_loads;
+    const size_t count = loads.size();
+    if (count < 2) return false;
+
+    const ConstantLoad& left = loads[count - 2];
+    const ConstantLoad& right = loads[count - 1];
+    if (right.start != right_start || right.end != current_chunk().count() || left.end != right_start) {
+        return false;
+    }
+
+    std::optional<Value> result = fold_binary_values(operator_type, left.value, right.value);
+    if (!result) return false;
+
+    current_chunk().truncate(left.start);
+    loads.resize(count - 2);
+    emit_value(*result);
+    return true;
+}
+
+bool Parser::fold_unary(TokenType operator_type, int operand_start)
+{
+    std::vector<ConstantLoad>& loads = compiler->constant_loads;
+    if (loads.empty() || loads.back().start != operand_start || loads.back().end != current_chunk().count()) {
+        return false;
+    }
+
+    const Value& operand = loads.back().value;
+    const double* number = std::get_if<double>(&operand);
+    std::optional<Value> result;
+    switch (operator_type) {
+        case TokenType::Excl:
+            result = Value(is_false(operand));
+            break;
+        case TokenType::Minus:
+            if (number != nullptr) result = Value(-*number);
+            break;
+        case TokenType::BwNot:
+            if (number != nullptr && *number > INT_MIN - 1.0 && *number < INT_MAX + 1.0) {
+                result = Value(static_cast<double>(~static_cast<int>(*number)));
+            }
+            break;
+        default:
+            break;
+    }
+    if (!result) return false;
+
+    current_chunk().truncate(operand_start);
+    loads.pop_back();
+    emit_value(*result);
+    return true;
 }
 
 void Parser::patch_jump(int offset)
@@ -254,11 +475,55 @@ void Parser::patch_jump(int offset)
     
     current_chunk().set_code(offset, (jump >> 8) & 0xff);
     current_chunk().set_code(offset + 1, jump & 0xff);
+
+    // The code before a jump target cannot be folded into what follows it.
+    compiler->constant_loads.clear();
+    compiler->last_comparison = -1;
+}
+
+void Parser::emit_comparison(Opcode op)
+{
+    compiler->last_comparison = current_chunk().count();
+    emit(op);
+}
+
+int Parser::emit_condition_jump(bool& pops_condition)
+{
+    // A comparison that ends the condition is replaced by its fused branch,
+    // which consumes the operands.
+    const int last = current_chunk().count() - 1;
+    if (compiler->last_comparison == last) {
+        std::optional<Opcode> fused;
+        switch (Opcode(current_chunk().get_code(last))) {
+            case Opcode::Equal:         fused = Opcode::JumpIfNotEqual; break;
+            case Opcode::NotEqual:      fused = Opcode::JumpIfEqual; break;
+            case Opcode::Greater:       fused = Opcode::JumpIfNotGreater; break;
+            case Opcode::GreaterEqual:  fused = Opcode::JumpIfNotGreaterEqual; break;
+            case Opcode::Less:          fused = Opcode::JumpIfNotLess; break;
+            case Opcode::LessEqual:     fused = Opcode::JumpIfNotLessEqual; break;
+            default: break;
+        }
+        if (fused) {
+            current_chunk().truncate(last);
+            compiler->last_comparison = -1;
+            pops_condition = false;
+            return emit_jump(*fused);
+        }
+    }
+
+    pops_condition = true;
+    const int jump = emit_jump(Opcode::JumpIfFalse);
+    emit(Opcode::Pop);
+    return jump;
 }
 
 Func Parser::end_compiler()
 {
     emit_return();
+
+    for (const LocalVar& local : compiler->locals) {
+        compiler->resolve_captures(local);
+    }
     
     Func function = compiler->function;
     
@@ -272,25 +537,121 @@ Func Parser::end_compiler()
     return function;
 }
 
+std::optional<Value> Parser::literal_element()
+{
+    auto ends_element = [](const Token& token) {
+        return token.get_type() == TokenType::Comma || token.get_type() == TokenType::CloseSquare;
+    };
+
+    switch (current.get_type()) {
+        case TokenType::Number:
+        case TokenType::String:
+        case TokenType::True:
+        case TokenType::False:
+        case TokenType::Null:
+            if (!ends_element(scanner.peek_token()))
+                return std::nullopt;
+            break;
+        case TokenType::Minus:
+            if (scanner.peek_token().get_type() != TokenType::Number || !ends_element(scanner.peek_token(1)))
+                return std::nullopt;
+            advance();
+            advance();
+            return -std::stod(std::string(previous.get_text()));
+        default:
+            return std::nullopt;
+    }
+
+    advance();
+    switch (previous.get_type()) {
+        case TokenType::Number: return std::stod(std::string(previous.get_text()));
+        case TokenType::True:   return true;
+        case TokenType::False:  return false;
+        case TokenType::Null:   return std::monostate();
+        default: {
+            std::string_view str = previous.get_text();
+            str.remove_prefix(1);
+            str.remove_suffix(1);
+            return std::string(str);
+        }
+    }
+}
+
 void Parser::array([[maybe_unused]] bool can_assign)
 {
-    size_t count = 0;
+    // Runs of literals become array templates of the chunk, cloned or
+    // appended as a whole. Other elements go through the stack and are
+    // appended at most 255 at a time, so literals have no size limit.
+    bool started = false;
+    uint8_t pending = 0;
+    ArrayObj::Storage run;
+
+    auto flush_pending = [&]() {
+        if (pending == 0)
+            return;
+        emit(started ? Opcode::ArrAppend : Opcode::ArrBuild, pending);
+        started = true;
+        pending = 0;
+    };
+    auto flush_run = [&]() {
+        if (run.empty())
+            return;
+        flush_pending();
+        const size_t index = current_chunk().add_template(std::make_shared<ArrayObj>(std::move(run)));
+        if (index > UINT16_MAX)
+            error("Too many array literals in one chunk.");
+        emit(started ? Opcode::ArrExtend : Opcode::ArrClone);
+        emit(static_cast<uint8_t>((index >> 8) & 0xff));
+        emit(static_cast<uint8_t>(index & 0xff));
+        started = true;
+        run.clear();
+    };
 
     if (!check(TokenType::CloseSquare)) {
         do {
             if (check(TokenType::CloseSquare)) break;
+
+            if (std::optional<Value> value = literal_element()) {
+                run.push_back(std::move(*value));
+                continue;
+            }
+
+            flush_run();
             parse_precedence(PrecedenceType::Or);
+            if (++pending == UINT8_MAX)
+                flush_pending();
+        } while (match(TokenType::Comma));
+    }
+
+    consume(TokenType::CloseSquare, "Expected ']' after list literal.");
+
+    flush_run();
+    flush_pending();
+    if (!started)
+        emit(Opcode::ArrBuild, 0);
+}
 
-            if (count == UINT8_COUNT)
-                error("List literals do not allow more than 255 items.");
+void Parser::map([[maybe_unused]] bool can_assign)
+{
+    size_t count = 0;
+
+    if (!check(TokenType::CloseCurly)) {
+        do {
+            if (check(TokenType::CloseCurly)) break;
+            parse_precedence(PrecedenceType::Or);
+            consume(TokenType::Colon, "Expected ':' after map key.");
+            parse_precedence(PrecedenceType::Or);
+
+            if (count == UINT8_MAX)
+                error("Map literals do not allow more than 255 entries.");
 
             count++;
         } while (match(TokenType::Comma));
     }
 
-    consume(TokenType::CloseSquare, "Expected ']' after list literal.");
+    consume(TokenType::CloseCurly, "Expected '}' after map literal.");
 
-    emit(Opcode::ArrBuild);
+    emit(Opcode::MapBuild);
     emit(static_cast<uint8_t>(count));
 }
 
@@ -303,6 +664,9 @@ void Parser::array_idx([[maybe_unused]] bool can_assign)
         expression();
         emit(Opcode::ArrStore);
     }
+    else if (auto mode = match_update(can_assign)) {
+        emit(Opcode::CompoundIndex, *mode);
+    }
     else {
         emit(Opcode::ArrIndex);
     }
@@ -315,16 +679,19 @@ void Parser::binary([[maybe_unused]] bool can_assign)
     
     // Compile the right operand.
     ParseRule rule = get_rule(operator_type);
+    const int right_start = current_chunk().count();
     parse_precedence(PrecedenceType(static_cast<int>(rule.precedence) + 1));
+
+    if (fold_binary(operator_type, right_start)) return;
     
     // Emit the operator instruction.
     switch (operator_type) {
-        case TokenType::ExclEqual:      emit(Opcode::Equal, Opcode::Not); break;
-        case TokenType::EqualEqual:     emit(Opcode::Equal); break;
-        case TokenType::Greater:        emit(Opcode::Greater); break;
-        case TokenType::GreaterEqual:   emit(Opcode::Less, Opcode::Not); break;
-        case TokenType::Less:           emit(Opcode::Less); break;
-        case TokenType::LessEqual:      emit(Opcode::Greater, Opcode::Not); break;
+        case TokenType::ExclEqual:      emit_comparison(Opcode::NotEqual); break;
+        case TokenType::EqualEqual:     emit_comparison(Opcode::Equal); break;
+        case TokenType::Greater:        emit_comparison(Opcode::Greater); break;
+        case TokenType::GreaterEqual:   emit_comparison(Opcode::GreaterEqual); break;
+        case TokenType::Less:           emit_comparison(Opcode::Less); break;
+        case TokenType::LessEqual:      emit_comparison(Opcode::LessEqual); break;
         case TokenType::Plus:           emit(Opcode::Add); break;
         case TokenType::Minus:          emit(Opcode::Subtract); break;
         case TokenType::Star:           emit(Opcode::Multiply); break;
@@ -341,33 +708,270 @@ void Parser::binary([[maybe_unused]] bool can_assign)
 
 void Parser::call([[maybe_unused]] bool can_assign)
 {
+    // Calls of a top level function declared above may be inlined.
+    Func callee;
+    if (compiler->last_global_end == current_chunk().count()) {
+        const auto found = inline_functions.find(compiler->last_global);
+        if (found != inline_functions.end()) callee = found->second;
+    }
+
     uint8_t arg_count = args_list();
+    if (callee != nullptr && emit_inline(callee, arg_count, -1)) return;
     emit(Opcode::Call, arg_count);
 }
 
+bool Parser::emit_inline(const Func& callee, uint8_t arg_count, int method_name)
+{
+    Chunk& body = callee->get_chunk();
+    if (compiler->unpacking || callee->arity != arg_count || callee->upvalue_count != 0 || body.count() > INLINE_MAX_SIZE) {
+        return false;
+    }
+
+    // Locals of the callee become slots counted from the top of the stack,
+    // so the depth above the callee is followed through the body. Forward
+    // jumps carry it to their targets. A return drops everything under the
+    // result and leaves the body.
+    struct BodyJump {
+        size_t operand;
+        int target;
+    };
+    std::vector<uint8_t> code;
+    std::vector<std::pair<size_t, uint8_t>> constants;
+    std::vector<BodyJump> jumps;
+    std::vector<size_t> exits;
+    std::vector<int> translated(body.count(), -1);
+    std::unordered_map<int, int> target_depths;
+    int depth = arg_count + 1;
+    bool reachable = true;
+
+    for (int offset = 0; offset < body.count();) {
+        if (const auto found = target_depths.find(offset); found != target_depths.end()) {
+            if (reachable && found->second != depth) return false;
+            depth = found->second;
+            reachable = true;
+        }
+
+        const Opcode op = Opcode(body.get_code(offset));
+        if (!reachable) {
+            // Jumps over an else branch and the implicit return may follow
+            // an explicit one.
+            if (op == Opcode::Jump) {
+                offset += 3;
+            } else if (op == Opcode::Nop || op == Opcode::Return) {
+                offset++;
+            } else {
+                return false;
+            }
+            continue;
+        }
+        translated[offset] = static_cast<int>(code.size());
+
+        int effect;
+        switch (op) {
+            case Opcode::Nop:
+            case Opcode::True:
+            case Opcode::False:
+            case Opcode::Constant:
+            case Opcode::GetGlobal:
+            case Opcode::GetLocal:
+                effect = 1;
+                break;
+            case Opcode::Not:
+            case Opcode::Negate:
+            case Opcode::BwNot:
+            case Opcode::GetProperty:
+            case Opcode::GetField:
+            case Opcode::SetGlobal:
+            case Opcode::SetLocal:
+            case Opcode::Jump:
+            case Opcode::JumpIfFalse:
+            case Opcode::Return:
+                effect = 0;
+                break;
+            case Opcode::Pop:
+            case Opcode::Print:
+            case Opcode::Equal:
+            case Opcode::NotEqual:
+            case Opcode::Greater:
+            case Opcode::GreaterEqual:
+            case Opcode::Less:
+            case Opcode::LessEqual:
+            case Opcode::Add:
+            case Opcode::Subtract:
+            case Opcode::Multiply:
+            case Opcode::Divide:
+            case Opcode::BwAnd:
+            case Opcode::BwOr:
+            case Opcode::BwXor:
+            case Opcode::ShiftLeft:
+            case Opcode::ShiftRight:
+            case Opcode::ArrIndex:
+            case Opcode::SetProperty:
+            case Opcode::SetField:
+                effect = -1;
+                break;
+            case Opcode::ArrStore:
+            case Opcode::JumpIfNotEqual:
+            case Opcode::JumpIfEqual:
+            case Opcode::JumpIfNotGreater:
+            case Opcode::JumpIfNotGreaterEqual:
+            case Opcode::JumpIfNotLess:
+            case Opcode::JumpIfNotLessEqual:
+                effect = -2;
+                break;
+            default:
+                return false;
+        }
+
+        switch (op) {
+            case Opcode::Constant:
+            case Opcode::GetGlobal:
+            case Opcode::SetGlobal:
+            case Opcode::GetProperty:
+            case Opcode::SetProperty:
+                code.push_back(static_cast<uint8_t>(op));
+                constants.emplace_back(code.size(), body.get_code(offset + 1));
+                code.push_back(0);
+                offset += 2;
+                break;
+            case Opcode::GetField:
+            case Opcode::SetField:
+                code.push_back(static_cast<uint8_t>(op));
+                constants.emplace_back(code.size(), body.get_code(offset + 1));
+                code.push_back(0);
+                code.push_back(body.get_code(offset + 2));
+                offset += 3;
+                break;
+            case Opcode::GetLocal:
+            case Opcode::SetLocal: {
+                const int distance = depth - 1 - body.get_code(offset + 1);
+                if (distance < 0 || distance > UINT8_MAX) return false;
+                code.push_back(static_cast<uint8_t>(op == Opcode::GetLocal ? Opcode::GetSlot : Opcode::SetSlot));
+                code.push_back(static_cast<uint8_t>(distance));
+                offset += 2;
+                break;
+            }
+            case Opcode::Jump:
+            case Opcode::JumpIfFalse:
+            case Opcode::JumpIfNotEqual:
+            case Opcode::JumpIfEqual:
+            case Opcode::JumpIfNotGreater:
+            case Opcode::JumpIfNotGreaterEqual:
+            case Opcode::JumpIfNotLess:
+            case Opcode::JumpIfNotLessEqual: {
+                const int target = offset + 3 + ((body.get_code(offset + 1) << 8) | body.get_code(offset + 2));
+                const auto [found, inserted] = target_depths.emplace(target, depth + effect);
+                if (!inserted && found->second != depth + effect) return false;
+                code.push_back(static_cast<uint8_t>(op));
+                jumps.push_back(BodyJump{ code.size(), target });
+                code.push_back(0);
+                code.push_back(0);
+                offset += 3;
+                reachable = op != Opcode::Jump;
+                break;
+            }
+            case Opcode::Return:
+                if (depth - 1 > UINT8_MAX) return false;
+                code.push_back(static_cast<uint8_t>(Opcode::InlineEnd));
+                code.push_back(static_cast<uint8_t>(depth - 1));
+                code.push_back(static_cast<uint8_t>(Opcode::Jump));
+                exits.push_back(code.size());
+                code.push_back(0);
+                code.push_back(0);
+                offset += 1;
+                reachable = false;
+                break;
+            default:
+                code.push_back(static_cast<uint8_t>(op));
+                offset += 1;
+                break;
+        }
+        depth += effect;
+        if (depth < 1) return false;
+    }
+
+    // The last return falls through to the end.
+    if (!exits.empty() && exits.back() + 2 == code.size()) {
+        code.resize(code.size() - 3);
+        exits.pop_back();
+    }
+    auto patch = [&code](size_t operand, int destination) {
+        const int jump = destination - static_cast<int>(operand) - 2;
+        if (jump < 0 || jump > UINT16_MAX) return false;
+        code[operand] = static_cast<uint8_t>((jump >> 8) & 0xff);
+        code[operand + 1] = static_cast<uint8_t>(jump & 0xff);
+        return true;
+    };
+    for (const BodyJump& jump : jumps) {
+        if (jump.target >= body.count() || translated[jump.target] == -1) return false;
+        if (!patch(jump.operand, translated[jump.target])) return false;
+    }
+    for (size_t exit : exits) {
+        if (!patch(exit, static_cast<int>(code.size()))) return false;
+    }
+
+    // The guard checks the callee, the body follows and a regular call
+    // jumps over it.
+    if (method_name == -1) {
+        emit(Opcode::InlineCall, arg_count);
+    } else {
+        emit(Opcode::InlineInvoke, static_cast<uint8_t>(method_name));
+        emit(arg_count);
+    }
+    emit(make_constant(callee));
+    emit(0xff);
+    emit(0xff);
+    const int skip = current_chunk().count() - 2;
+    for (const auto& [operand, constant] : constants) {
+        code[operand] = make_constant(callee->get_const(constant));
+    }
+    for (uint8_t byte : code) {
+        emit(byte);
+    }
+    patch_jump(skip);
+    return true;
+}
+
 void Parser::dot([[maybe_unused]] bool can_assign)
 {
     consume(TokenType::Identifier, "Expected property name after '.'.");
-    int name = identifier_constant(std::string(previous.get_text()));
+    const std::string property = std::string(previous.get_text());
     
     if (can_assign && match(TokenType::Equal)) {
         expression();
-        emit(Opcode::SetProperty, static_cast<uint8_t>(name));
+        if (auto slot = struct_field(property)) {
+            emit(Opcode::SetField, slot->first);
+            emit(slot->second);
+        } else {
+            emit(Opcode::SetProperty, static_cast<uint8_t>(identifier_constant(property)));
+        }
+    } else if (auto mode = match_update(can_assign)) {
+        emit(Opcode::CompoundProperty, static_cast<uint8_t>(identifier_constant(property)));
+        emit(*mode);
     } else if (match(TokenType::OpenParen)) {
+        int name = identifier_constant(property);
         uint8_t arg_count = args_list();
+        const auto method = inline_methods.find(property);
+        if (method != inline_methods.end() && method->second != nullptr
+            && emit_inline(method->second, arg_count, name)) {
+            return;
+        }
         emit(Opcode::Invoke, static_cast<uint8_t>(name));
         emit(arg_count);
+    } else if (auto slot = struct_field(property)) {
+        emit(Opcode::GetField, slot->first);
+        emit(slot->second);
     } else {
-        emit(Opcode::GetProperty, static_cast<uint8_t>(name));
+        emit(Opcode::GetProperty, static_cast<uint8_t>(identifier_constant(property)));
     }
 }
 
 void Parser::literal([[maybe_unused]] bool can_assign)
 {
     switch (previous.get_type()) {
-        case TokenType::False:  emit(Opcode::False); break;
-        case TokenType::Null:   emit(Opcode::Nop); break;
-        case TokenType::True:   emit(Opcode::True); break;
+        case TokenType::False:  emit_value(false); break;
+        case TokenType::Null:   emit_value(std::monostate()); break;
+        case TokenType::True:   emit_value(true); break;
         default:                return; // Unreachable.
     }
 }
@@ -404,29 +1008,196 @@ void Parser::string_([[maybe_unused]] bool can_assign)
     emit_constant(std::string(str));
 }
 
+void Parser::template_string([[maybe_unused]] bool can_assign)
+{
+    // The rest of a template after an empty '${}'.
+    if (previous.get_text().front() == '}') {
+        error("Expected expression.");
+        return;
+    }
+
+    // Text and values alternate, Interpolate joins them all at once.
+    int parts = 0;
+    int values = 0;
+    auto text = [this, &parts]() {
+        std::string_view str = previous.get_text();
+        str.remove_prefix(1);
+        str.remove_suffix(previous.get_type() == TokenType::TemplatePart ? 2 : 1);
+        if (!str.empty()) {
+            emit_constant(std::string(str));
+            parts++;
+        }
+    };
+
+    while (previous.get_type() == TokenType::TemplatePart) {
+        text();
+        expression();
+        parts++;
+        values++;
+        if (!match(TokenType::TemplatePart) && !match(TokenType::Template)) {
+            error_at_current("Expected '}' after template expression.");
+            return;
+        }
+    }
+    text();
+
+    if (parts > UINT8_MAX) {
+        error("Too many parts in template string.");
+    } else if (parts == 0) {
+        emit_constant(std::string());
+    } else if (values > 0) {
+        emit(Opcode::Interpolate, static_cast<uint8_t>(parts));
+    }
+}
+
 void Parser::named_variable(const std::string& name, bool can_assign)
 {
+    if (const Value* constant = compiler->resolve_constant(name)) {
+        if (can_assign && match(TokenType::Equal)) {
+            error("Cannot assign to a constant.");
+            expression();
+            return;
+        }
+        if (match_update(can_assign)) {
+            error("Cannot assign to a constant.");
+            return;
+        }
+        emit_value(Value(*constant));
+        return;
+    }
+
     Opcode get_op;
     Opcode set_op;
+    Opcode compound_op;
     int arg = compiler->resolve_local(name);
     if (arg != -1) {
         get_op = Opcode::GetLocal;
         set_op = Opcode::SetLocal;
+        compound_op = Opcode::CompoundLocal;
     } else if ((arg = compiler->resolve_upvalue(name)) != -1) {
         get_op = Opcode::GetUpvalue;
         set_op = Opcode::SetUpvalue;
+        compound_op = Opcode::CompoundUpvalue;
     } else {
         arg = identifier_constant(name);
         get_op = Opcode::GetGlobal;
         set_op = Opcode::SetGlobal;
+        compound_op = Opcode::CompoundGlobal;
     }
     
+    std::optional<uint8_t> mode;
     if (can_assign && match(TokenType::Equal)) {
         expression();
+        if (set_op == Opcode::SetLocal) {
+            compiler->locals[arg].is_assigned = true;
+        } else if (set_op == Opcode::SetUpvalue) {
+            compiler->mark_upvalue_assigned(arg);
+        }
         emit(set_op, (uint8_t)arg);
+    } else if ((mode = match_update(can_assign))) {
+        if (compound_op == Opcode::CompoundLocal) {
+            compiler->locals[arg].is_assigned = true;
+        } else if (compound_op == Opcode::CompoundUpvalue) {
+            compiler->mark_upvalue_assigned(arg);
+        }
+        emit(compound_op, (uint8_t)arg);
+        emit(*mode);
     } else {
         emit(get_op, (uint8_t)arg);
+        if (get_op == Opcode::GetGlobal) {
+            compiler->last_global = name;
+            compiler->last_global_end = current_chunk().count();
+        }
+    }
+}
+
+void Parser::import_constants()
+{
+    // Only an import the script runs for sure, with a literal library name,
+    // is known before running.
+    if (library_constants == nullptr || compiler->type != FunctionType::Script || compiler->scope_depth != 0) return;
+    if (!check(TokenType::Identifier) || current.get_text() != "import") return;
+    const Token library = scanner.peek_token(1);
+    if (scanner.peek_token().get_type() != TokenType::OpenParen || library.get_type() != TokenType::String
+        || scanner.peek_token(2).get_type() != TokenType::CloseParen
+        || scanner.peek_token(3).get_type() != TokenType::Semicolon) return;
+
+    std::string_view library_name = library.get_text();
+    library_name.remove_prefix(1);
+    library_name.remove_suffix(1);
+    if (const auto* library_values = library_constants(std::string(library_name))) {
+        const auto& names = written_names();
+        for (const auto& [constant, value] : *library_values) {
+            if (names.count(constant) != 0 || (constants.count(constant) != 0 && library_names.count(constant) == 0)) {
+                continue;
+            }
+            constants[constant] = value;
+            library_names.insert(constant);
+        }
+        lazy_constants.reset();
+    }
+}
+
+const std::unordered_set<std::string>& Parser::written_names()
+{
+    if (written) return *written;
+
+    written.emplace();
+    Tokenizer tokens(scanner.get_source());
+    TokenType before = TokenType::Eof;
+    Token token = tokens.scan_token();
+    bool declaring = false;
+    while (token.get_type() != TokenType::Eof) {
+        const Token next = tokens.scan_token();
+        if (token.get_type() == TokenType::Identifier && before != TokenType::Dot) {
+            switch (before) {
+                case TokenType::Var:
+                case TokenType::Const:
+                case TokenType::Func:
+                case TokenType::Class:
+                case TokenType::Struct:
+                case TokenType::PlusPlus:
+                case TokenType::MinusMinus:
+                    written->emplace(token.get_text());
+                    break;
+                case TokenType::Comma:
+                    if (declaring) written->emplace(token.get_text());
+                    break;
+                default:
+                    break;
+            }
+            switch (next.get_type()) {
+                case TokenType::Equal:
+                case TokenType::PlusEqual: case TokenType::MinusEqual:
+                case TokenType::StarEqual: case TokenType::SlashEqual:
+                case TokenType::BwAndEqual: case TokenType::BwOrEqual: case TokenType::BwXorEqual:
+                case TokenType::LessLessEqual: case TokenType::GreaterGreaterEqual:
+                case TokenType::PlusPlus: case TokenType::MinusMinus:
+                    written->emplace(token.get_text());
+                    break;
+                default:
+                    break;
+            }
+        }
+        // The names of 'var a, b = ...' up to the '='.
+        if (token.get_type() == TokenType::Var) {
+            declaring = true;
+        } else if (token.get_type() == TokenType::Equal || token.get_type() == TokenType::Semicolon) {
+            declaring = false;
+        }
+        before = token.get_type();
+        token = next;
+    }
+    return *written;
+}
+
+std::unordered_map<std::string, Value> Parser::get_constants() const
+{
+    std::unordered_map<std::string, Value> declared = constants;
+    for (const std::string& name : library_names) {
+        declared.erase(name);
     }
+    return declared;
 }
 
 void Parser::variable([[maybe_unused]] bool can_assign)
@@ -475,7 +1246,10 @@ void Parser::unary([[maybe_unused]] bool can_assign)
     TokenType operator_type = previous.get_type();
     
     // Compile the operand.
+    const int operand_start = current_chunk().count();
     parse_precedence(PrecedenceType::Unary);
+
+    if (fold_unary(operator_type, operand_start)) return;
     
     // Emit the operator instruciton.
     switch (operator_type) {
@@ -488,6 +1262,59 @@ void Parser::unary([[maybe_unused]] bool can_assign)
     }
 }
 
+void Parser::prefix_update([[maybe_unused]] bool can_assign)
+{
+    // The target is parsed like the operand of a call, its handler applies
+    // the update once nothing follows it.
+    const TokenType operator_type = previous.get_type();
+    advance();
+    ParseFn prefix_rule = get_rule(previous.get_type()).prefix;
+    if (prefix_rule == nullptr) {
+        error("Expected expression.");
+        return;
+    }
+
+    pending_update = operator_type;
+    prefix_rule(false);
+    while (PrecedenceType::Call <= get_rule(current.get_type()).precedence) {
+        advance();
+        get_rule(previous.get_type()).infix(false);
+    }
+
+    if (pending_update) {
+        pending_update.reset();
+        error("Invalid increment target.");
+    }
+}
+
+std::optional<uint8_t> Parser::match_update(bool can_assign)
+{
+    if (pending_update) {
+        if (check(TokenType::Dot) || check(TokenType::OpenSquare) || check(TokenType::OpenParen)) {
+            return std::nullopt;
+        }
+        const Opcode op = *pending_update == TokenType::PlusPlus ? Opcode::Add : Opcode::Subtract;
+        pending_update.reset();
+        emit_value(1.0);
+        return static_cast<uint8_t>(op);
+    }
+
+    if (can_assign) {
+        if (std::optional<Opcode> op = compound_operator(current.get_type())) {
+            advance();
+            expression();
+            return static_cast<uint8_t>(*op);
+        }
+    }
+
+    if (match(TokenType::PlusPlus) || match(TokenType::MinusMinus)) {
+        const Opcode op = previous.get_type() == TokenType::PlusPlus ? Opcode::Add : Opcode::Subtract;
+        emit_value(1.0);
+        return static_cast<uint8_t>(static_cast<uint8_t>(op) | COMPOUND_POSTFIX);
+    }
+    return std::nullopt;
+}
+
 ParseRule& Parser::get_rule(TokenType type)
 {
     return rules[static_cast<int>(type)];
@@ -502,6 +1329,7 @@ void Parser::build_parse_rules()
     std::function<void(bool)> dot = [this](bool can_assign) { this->dot(can_assign); };
     std::function<void(bool)> number = [this](bool can_assign) { this->number(can_assign); };
     std::function<void(bool)> string = [this](bool can_assign) { this->string_(can_assign); };
+    std::function<void(bool)> template_ = [this](bool can_assign) { this->template_string(can_assign); };
     std::function<void(bool)> literal = [this](bool can_assign) { this->literal(can_assign); };
     std::function<void(bool)> variable = [this](bool can_assign) { this->variable(can_assign); };
     std::function<void(bool)> super_ = [this](bool can_assign) { this->super(can_assign); };
@@ -510,11 +1338,13 @@ void Parser::build_parse_rules()
     std::function<void(bool)> or_ = [this](bool can_assign) { this->or_(can_assign); };
     std::function<void(bool)> array = [this](bool can_assign) { this->array(can_assign); };
     std::function<void(bool)> array_idx = [this](bool can_assign) { this->array_idx(can_assign); };
+    std::function<void(bool)> map = [this](bool can_assign) { this->map(can_assign); };
+    std::function<void(bool)> update = [this](bool can_assign) { this->prefix_update(can_assign); };
 
     rules = { {
         { grouping,    call,       PrecedenceType::Call },       // TOKEN_LEFT_PAREN
         { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_RIGHT_PAREN
-        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_LEFT_BRACE
+        { map,         nullptr,    PrecedenceType::None },       // TOKEN_LEFT_BRACE
         { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_RIGHT_BRACE
         { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_COMMA
         { nullptr,     dot,        PrecedenceType::Call },       // TOKEN_DOT
@@ -556,10 +1386,31 @@ void Parser::build_parse_rules()
         { nullptr,     binary,     PrecedenceType::Term },       // TOKEN_BW_OR
         { nullptr,     binary,     PrecedenceType::Term },       // TOKEN_BW_XOR
         { unary,       nullptr,    PrecedenceType::Unary},       // TOKEN_BW_NOT
-        { array,       array_idx,  PrecedenceType::Or   },       // TOKEN_OPEN_SQUARE
+        { array,       array_idx,  PrecedenceType::Call },       // TOKEN_OPEN_SQUARE
         { unary,       nullptr,    PrecedenceType::None },       // TOKEN_CLOSE_SQUARE
         { nullptr,     binary,     PrecedenceType::Term },       // TOKEN_LESS_LESS
         { nullptr,     binary,     PrecedenceType::Term },       // TOKEN_GREATER_GREATER
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_COLON
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_STRUCT
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_CONST
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_IN
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_DOT_DOT
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_PLUS_EQUAL
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_MINUS_EQUAL
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_STAR_EQUAL
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_SLASH_EQUAL
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_BW_AND_EQUAL
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_BW_OR_EQUAL
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_BW_XOR_EQUAL
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_LESS_LESS_EQUAL
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_GREATER_GREATER_EQUAL
+        { update,      nullptr,    PrecedenceType::None },       // TOKEN_PLUS_PLUS
+        { update,      nullptr,    PrecedenceType::None },       // TOKEN_MINUS_MINUS
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_SWITCH
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_CASE
+        { nullptr,     nullptr,    PrecedenceType::None },       // TOKEN_DEFAULT
+        { template_,   nullptr,    PrecedenceType::None },       // TOKEN_TEMPLATE_PART
+        { template_,   nullptr,    PrecedenceType::None },       // TOKEN_TEMPLATE
     } };
 }
 
@@ -571,6 +1422,9 @@ void Parser::parse_precedence(PrecedenceType precedence)
         error("Expected expression.");
         return;
     }
+
+    // A nested expression is never the target of a pending prefix update.
+    const std::optional<TokenType> pending = std::exchange(pending_update, std::nullopt);
     
     bool can_assign = precedence <= PrecedenceType::Assignment;
     prefix_rule(can_assign);
@@ -580,8 +1434,11 @@ void Parser::parse_precedence(PrecedenceType precedence)
         ParseFn infix_rule = get_rule(previous.get_type()).infix;
         infix_rule(can_assign);
     }
+
+    pending_update = pending;
     
-    if (can_assign && match(TokenType::Equal)) {
+    if (can_assign && (check(TokenType::Equal) || compound_operator(current.get_type()))) {
+        advance();
         error("Invalid assignment target.");
         expression();
     }
@@ -642,7 +1499,7 @@ void Parser::block()
     consume(TokenType::CloseCurly, "Expected '}' after block.");
 }
 
-void Parser::function(FunctionType type)
+Func Parser::function(FunctionType type)
 {
     compiler = std::make_unique<Compiler>(this, type, std::move(compiler));
     compiler->begin_scope();
@@ -668,18 +1525,89 @@ void Parser::function(FunctionType type)
     emit(Opcode::Closure, make_constant(function));
     
     for (const UpvalueVar& upvalue : new_compiler->upvalues) {
-        emit(upvalue.is_local ? 1 : 0);
+        if (upvalue.is_local) {
+            // Boxed until the local's scope ends and we know it is never reassigned.
+            compiler->locals[upvalue.index].capture_sites.push_back(current_chunk().count());
+            emit(static_cast<uint8_t>(CaptureKind::Boxed));
+        } else {
+            emit(static_cast<uint8_t>(CaptureKind::Upvalue));
+        }
         emit(upvalue.index);
     }
+    return function;
+}
+
+Func Parser::lazy_function()
+{
+    // Top level functions capture nothing, the body is compiled on its own
+    // later with the constants visible here.
+    const Token open = current;
+    Func function = std::make_shared<FunctionObj>(0, std::string(previous.get_text()));
+
+    consume(TokenType::OpenParen, "Expected '(' after function name.");
+    if (!check(TokenType::CloseParen)) {
+        do {
+            function->arity++;
+            if (function->arity > 255)
+                error_at_current("A function cannot have more than 255 parameters.");
+            consume(TokenType::Identifier, "Expected parameter name.");
+        } while (match(TokenType::Comma));
+    }
+    consume(TokenType::CloseParen, "Expected ')' after parameters.");
+    if (!check(TokenType::OpenCurly)) {
+        error_at_current("Expected '{' before function body.");
+        return function;
+    }
+
+    current = scanner.skip_block();
+    if (current.get_type() != TokenType::CloseCurly) {
+        error_at_current("Expected '}' after block.");
+        return function;
+    }
+    const std::string_view first = open.get_text();
+    const std::string_view last = current.get_text();
+    advance();
+
+    if (lazy_constants == nullptr) {
+        lazy_constants = std::make_shared<const std::unordered_map<std::string, Value>>(constants);
+    }
+    function->lazy = std::make_shared<LazyFunction>(LazyFunction{
+        std::string(first.data(), last.data() + last.size()), open.get_line(), lazy_constants, lazy_scope });
+
+    emit(Opcode::Closure, make_constant(function));
+    return function;
+}
+
+bool Parser::compile_lazy(const Func& function, LibraryConstants library_constants)
+{
+    const LazyFunction& lazy = *function->lazy;
+    Parser parser(lazy.source, *lazy.constants, std::move(library_constants), lazy.line);
+    parser.struct_types = lazy.scope->struct_types;
+    parser.inline_methods = lazy.scope->inline_methods;
+    parser.previous = Token(TokenType::Identifier, function->name, lazy.line);
+
+    Func compiled = parser.function(FunctionType::Function);
+    if (parser.had_error) return false;
+
+    function->chunk = std::move(compiled->chunk);
+    function->lazy.reset();
+    return true;
 }
 
 void Parser::method()
 {
     consume(TokenType::Identifier, "Expected method name.");
-    const int constant = identifier_constant(std::string(previous.get_text()));
-    const FunctionType type = previous.get_text() == "init" ? FunctionType::Initializer : FunctionType::Method;
-    function(type);
+    const std::string name = std::string(previous.get_text());
+    const int constant = identifier_constant(name);
+    const FunctionType type = name == "init" ? FunctionType::Initializer : FunctionType::Method;
+    Func method = function(type);
     emit(Opcode::Method, static_cast<uint8_t>(constant));
+
+    // Invocations by name can only be inlined while one body answers to it.
+    if (type == FunctionType::Method) {
+        const auto [found, inserted] = inline_methods.emplace(name, method);
+        if (!inserted && found->second != method) found->second = nullptr;
+    }
 }
 
 void Parser::class_declaration()
@@ -726,18 +1654,129 @@ void Parser::class_declaration()
     class_compiler = std::move(class_compiler->enclosing);
 }
 
+void Parser::struct_declaration()
+{
+    consume(TokenType::Identifier, "Expected struct name.");
+    std::string struct_name = std::string(previous.get_text());
+    const int name_constant = identifier_constant(struct_name);
+    compiler->declare_variable(struct_name);
+
+    consume(TokenType::OpenCurly, "Expected '{' before struct fields.");
+    std::vector<std::string> fields;
+    if (!check(TokenType::CloseCurly)) {
+        do {
+            if (check(TokenType::CloseCurly)) break;
+            consume(TokenType::Identifier, "Expected field name.");
+
+            std::string field = std::string(previous.get_text());
+            if (std::find(fields.begin(), fields.end(), field) != fields.end())
+                error("Duplicate field in struct.");
+            if (fields.size() == UINT8_COUNT)
+                error("A struct cannot have more than 256 fields.");
+            fields.push_back(std::move(field));
+        } while (match(TokenType::Comma));
+    }
+    consume(TokenType::CloseCurly, "Expected '}' after struct fields.");
+
+    // The layout is known now: later field accesses use slots.
+    Struct type = std::make_shared<StructObj>(std::move(struct_name), std::move(fields));
+    struct_types.push_back(type);
+
+    emit_constant(type);
+    define_variable(static_cast<uint8_t>(name_constant));
+}
+
+std::optional<std::pair<uint8_t, uint8_t>> Parser::struct_field(std::string_view field)
+{
+    for (auto type = struct_types.rbegin(); type != struct_types.rend(); ++type) {
+        const int index = (*type)->field_index(field);
+        if (index != -1)
+            return std::make_pair(make_constant(*type), static_cast<uint8_t>(index));
+    }
+    return std::nullopt;
+}
+
+void Parser::const_declaration()
+{
+    consume(TokenType::Identifier, "Expected constant name.");
+    const std::string name = std::string(previous.get_text());
+    compiler->check_redeclaration(name);
+
+    consume(TokenType::Equal, "Expected '=' after constant name.");
+    const int start = current_chunk().count();
+    expression();
+    consume(TokenType::Semicolon, "Expected ';' after constant declaration.");
+
+    // The initializer must have folded into a single load.
+    const std::vector<ConstantLoad>& loads = compiler->constant_loads;
+    if (loads.empty() || loads.back().start != start || loads.back().end != current_chunk().count()) {
+        error("Constant initializer must be a constant expression.");
+        return;
+    }
+    Value value = loads.back().value;
+    current_chunk().truncate(start);
+    compiler->constant_loads.pop_back();
+
+    if (compiler->is_local()) {
+        compiler->constants.push_back(ConstVar{ name, std::move(value), compiler->scope_depth });
+        return;
+    }
+
+    // Also a global, for the functions compiled before the declaration.
+    constants[name] = value;
+    lazy_constants.reset();
+    emit_value(value);
+    emit(Opcode::DefineGlobal, static_cast<uint8_t>(identifier_constant(name)));
+}
+
 void Parser::func_declaration()
 {
     uint8_t global = parse_variable("Expected function name.");
+    const std::string name = std::string(previous.get_text());
     compiler->mark_initialized();
-    function(FunctionType::Function);
+    if (lazy_functions && compiler->scope_depth == 0) {
+        // Bodies left for their first call cannot be inlined.
+        lazy_function();
+        define_variable(global);
+        return;
+    }
+    Func declared = function(FunctionType::Function);
     define_variable(global);
+    if (compiler->scope_depth == 0) inline_functions[name] = declared;
 }
 
 void Parser::var_declaration()
 {
     const uint8_t global = parse_variable("Expected variable name.");
 
+    if (check(TokenType::Comma)) {
+        // Several variables take the values unpacked from one expression.
+        std::vector<uint8_t> globals{ global };
+        while (match(TokenType::Comma)) {
+            if (globals.size() == UINT8_MAX) {
+                error("Too many variables in one declaration.");
+            }
+            globals.push_back(parse_variable("Expected variable name."));
+        }
+        consume(TokenType::Equal, "Expected '=' after variable names.");
+        // An inlined body gives one value, calls are kept for the Unpack
+        // to take all the values a return gives.
+        compiler->unpacking = true;
+        expression();
+        compiler->unpacking = false;
+        consume(TokenType::Semicolon, "Expected ';' after variable declaration.");
+        emit(Opcode::Unpack, static_cast<uint8_t>(globals.size()));
+
+        if (compiler->is_local()) {
+            compiler->mark_initialized(globals.size());
+            return;
+        }
+        for (auto name = globals.rbegin(); name != globals.rend(); ++name) {
+            emit(Opcode::DefineGlobal, *name);
+        }
+        return;
+    }
+
     if (match(TokenType::Equal)) {
         expression();
     } else {
@@ -760,6 +1799,12 @@ void Parser::for_statement()
     compiler->begin_scope();
     
     consume(TokenType::OpenParen, "Expected '(' after 'for'.");
+    if (check(TokenType::Identifier) && scanner.peek_token().get_type() == TokenType::In) {
+        for_in_statement();
+        compiler->end_scope();
+        return;
+    }
+
     if (match(TokenType::Var)) {
         var_declaration();
     } else if (match(TokenType::Semicolon)) {
@@ -771,13 +1816,13 @@ void Parser::for_statement()
     int loop_start = current_chunk().count();
     
     int exit_jump = -1;
+    bool pops_condition = false;
     if (!match(TokenType::Semicolon)) {
         expression();
         consume(TokenType::Semicolon, "Expected ';' after loop condition.");
         
         // Jump out of the loop if the condition is false.
-        exit_jump = emit_jump(Opcode::JumpIfFalse);
-        emit(Opcode::Pop);
+        exit_jump = emit_condition_jump(pops_condition);
     }
 
     if (!match(TokenType::CloseParen)) {
@@ -799,33 +1844,250 @@ void Parser::for_statement()
     
     if (exit_jump != -1) {
         patch_jump(exit_jump);
-        emit(Opcode::Pop); // Condition.
+        if (pops_condition) emit(Opcode::Pop); // Condition.
     }
 
     compiler->end_scope();
 }
 
+void Parser::for_in_statement()
+{
+    consume(TokenType::Identifier, "Expected loop variable name.");
+    const std::string name = std::string(previous.get_text());
+    consume(TokenType::In, "Expected 'in' after loop variable.");
+
+    // Hidden locals hold the loop state: the counter, the limit and the
+    // step of a range, or the iterated value and the position in it. The
+    // loop variable gets a copy of the current element on each iteration.
+    const uint8_t base = static_cast<uint8_t>(compiler->locals.size());
+    auto hidden_local = [this](const std::string& hidden) {
+        compiler->add_local(hidden);
+        compiler->mark_initialized();
+    };
+
+    expression();
+    const bool is_range = match(TokenType::DotDot);
+    if (is_range) {
+        hidden_local("(for index)");
+        expression();
+        hidden_local("(for limit)");
+        if (check(TokenType::Identifier) && current.get_text() == "step") {
+            advance();
+            expression();
+        } else {
+            emit_value(1.0);
+        }
+        hidden_local("(for step)");
+    } else {
+        hidden_local("(for iterable)");
+        emit_value(0.0);
+        hidden_local("(for position)");
+    }
+    consume(TokenType::CloseParen, "Expected ')' after for clause.");
+
+    emit(Opcode::Nop);
+    compiler->declare_variable(name);
+    compiler->mark_initialized();
+
+    // A range checks once before the body, IterNext is entered directly.
+    int entry_jump;
+    if (is_range) {
+        emit(Opcode::ForPrep, base);
+        entry_jump = current_chunk().count();
+        emit(0xff);
+        emit(0xff);
+    } else {
+        entry_jump = emit_jump(Opcode::Jump);
+    }
+
+    // The body is the target of ForLoop and IterNext.
+    const int body_start = current_chunk().count();
+    compiler->constant_loads.clear();
+    statement();
+
+    if (!is_range) patch_jump(entry_jump);
+    emit(is_range ? Opcode::ForLoop : Opcode::IterNext, base);
+    const int offset = current_chunk().count() - body_start + 2;
+    if (offset > UINT16_MAX) { error("Loop body too large."); }
+    emit((offset >> 8) & 0xff);
+    emit(offset & 0xff);
+
+    if (is_range) patch_jump(entry_jump);
+}
+
 void Parser::if_statement()
 {
     consume(TokenType::OpenParen, "Expected '(' after 'if'.");
     expression();
     consume(TokenType::CloseParen, "Expected ')' after condition.");
     
-    const int then_jump = emit_jump(Opcode::JumpIfFalse);
-    emit(Opcode::Pop);
+    bool pops_condition;
+    const int then_jump = emit_condition_jump(pops_condition);
     statement();
     const int else_jump = emit_jump(Opcode::Jump);
     
     patch_jump(then_jump);
-    emit(Opcode::Pop);
+    if (pops_condition) emit(Opcode::Pop);
     if (match(TokenType::Else)) { statement(); }
     patch_jump(else_jump);
 }
 
+void Parser::switch_statement()
+{
+    struct SwitchCase {
+        Value value;
+        int body_start;
+    };
+
+    compiler->begin_scope();
+    consume(TokenType::OpenParen, "Expected '(' after 'switch'.");
+    expression();
+    consume(TokenType::CloseParen, "Expected ')' after switch value.");
+    compiler->add_local("(switch)");
+    compiler->mark_initialized();
+    const uint8_t subject = static_cast<uint8_t>(compiler->locals.size() - 1);
+    consume(TokenType::OpenCurly, "Expected '{' before switch cases.");
+
+    // Every case value is known only after the bodies, so the dispatch
+    // comes last and jumps back to them. A body ends the switch.
+    const int dispatch_jump = emit_jump(Opcode::Jump);
+    std::vector<SwitchCase> cases;
+    std::vector<int> end_jumps;
+    int default_start = -1;
+
+    while (!check(TokenType::CloseCurly) && !check(TokenType::Eof)) {
+        const size_t first_case = cases.size();
+        const bool is_default = match(TokenType::Default);
+        if (is_default) {
+            if (default_start != -1) {
+                error("Already a default case in this switch.");
+            }
+            consume(TokenType::Colon, "Expected ':' after 'default'.");
+        } else {
+            consume(TokenType::Case, "Expected 'case' or 'default' in switch.");
+            do {
+                const int start = current_chunk().count();
+                expression();
+
+                // Like a constant initializer, the value must fold into a single load.
+                const std::vector<ConstantLoad>& loads = compiler->constant_loads;
+                if (loads.empty() || loads.back().start != start || loads.back().end != current_chunk().count()) {
+                    error("Case value must be a constant expression.");
+                    continue;
+                }
+                Value value = loads.back().value;
+                current_chunk().truncate(start);
+                compiler->constant_loads.pop_back();
+
+                for (const SwitchCase& other : cases) {
+                    if (values_equal(other.value, value)) {
+                        error("Duplicate case value.");
+                    }
+                }
+                cases.push_back(SwitchCase{ std::move(value), -1 });
+            } while (match(TokenType::Comma));
+            consume(TokenType::Colon, "Expected ':' after case value.");
+        }
+
+        // The body is a jump target of the dispatch.
+        const int body_start = current_chunk().count();
+        if (is_default) {
+            default_start = body_start;
+        }
+        for (size_t i = first_case; i < cases.size(); ++i) {
+            cases[i].body_start = body_start;
+        }
+        compiler->constant_loads.clear();
+        compiler->last_comparison = -1;
+
+        compiler->begin_scope();
+        while (!check(TokenType::Case) && !check(TokenType::Default) &&
+               !check(TokenType::CloseCurly) && !check(TokenType::Eof)) {
+            declaration();
+        }
+        compiler->end_scope();
+        end_jumps.push_back(emit_jump(Opcode::Jump));
+    }
+    consume(TokenType::CloseCurly, "Expected '}' after switch cases.");
+    patch_jump(dispatch_jump);
+
+    // Tables hold the distance back from the end of the dispatch to each
+    // body, 0 goes on to the end of the switch.
+    auto emit_short = [this](int value) {
+        if (value > UINT16_MAX) { error("Too much code to jump over."); }
+        emit((value >> 8) & 0xff);
+        emit(value & 0xff);
+    };
+
+    bool use_table = cases.size() >= SWITCH_TABLE_MIN_CASES;
+    bool integral = true;
+    double low = INT32_MAX;
+    double high = INT32_MIN;
+    for (const SwitchCase& c : cases) {
+        use_table = use_table && MapObj::is_hashable(c.value);
+        const double* number = std::get_if<double>(&c.value);
+        if (number == nullptr || *number != std::floor(*number) || std::abs(*number) > INT32_MAX) {
+            integral = false;
+        } else {
+            low = std::min(low, *number);
+            high = std::max(high, *number);
+        }
+    }
+    const double range = high - low + 1;
+
+    if (use_table && integral && range <= 2.0 * static_cast<double>(cases.size())) {
+        const int size = static_cast<int>(range);
+        const int end = current_chunk().count() + 8 + 2 * size;
+        emit(Opcode::GetLocal, subject);
+        emit(Opcode::JumpTable, make_constant(low));
+        emit_short(size);
+        emit_short(default_start == -1 ? 0 : end - default_start);
+        std::vector<int> targets(size, default_start);
+        for (const SwitchCase& c : cases) {
+            targets[static_cast<int>(std::get<double>(c.value) - low)] = c.body_start;
+        }
+        for (int target : targets) {
+            emit_short(target == -1 ? 0 : end - target);
+        }
+    } else if (use_table) {
+        const int end = current_chunk().count() + 6;
+        Map table = std::make_shared<MapObj>();
+        for (const SwitchCase& c : cases) {
+            table->insert(c.value, static_cast<double>(end - c.body_start));
+        }
+        emit(Opcode::GetLocal, subject);
+        emit(Opcode::SwitchMap, make_constant(table));
+        emit_short(default_start == -1 ? 0 : end - default_start);
+    } else {
+        for (const SwitchCase& c : cases) {
+            emit(Opcode::GetLocal, subject);
+            emit_value(c.value);
+            const int next_case = emit_jump(Opcode::JumpIfNotEqual);
+            emit_loop(c.body_start);
+            patch_jump(next_case);
+        }
+        if (default_start != -1) {
+            emit_loop(default_start);
+        }
+    }
+
+    for (int end_jump : end_jumps) {
+        patch_jump(end_jump);
+    }
+    compiler->end_scope();
+}
+
 void Parser::declaration()
 {
+    compiler->constant_loads.clear();
+    import_constants();
+
     if (match(TokenType::Class)) {
         class_declaration();
+    } else if (match(TokenType::Struct)) {
+        struct_declaration();
+    } else if (match(TokenType::Const)) {
+        const_declaration();
     } else if (match(TokenType::Func)) {
         func_declaration();
     } else if (match(TokenType::Var)) {
@@ -847,6 +2109,8 @@ void Parser::statement()
         if_statement();
     } else if (match(TokenType::Return)) {
         return_statement();
+    } else if (match(TokenType::Switch)) {
+        switch_statement();
     } else if (match(TokenType::While)) {
         while_statement();
     } else if (match(TokenType::OpenCurly)) {
@@ -879,8 +2143,21 @@ void Parser::return_statement()
         }
         
         expression();
+        int count = 1;
+        while (match(TokenType::Comma)) {
+            expression();
+            if (++count > UINT8_MAX) {
+                error("Cannot return more than 255 values.");
+            }
+        }
         consume(TokenType::Semicolon, "Expected ';' after return value.");
-        emit(Opcode::Return);
+
+        // Several values are left on the stack, for an Unpack after the call.
+        if (count == 1) {
+            emit(Opcode::Return);
+        } else {
+            emit(Opcode::ReturnValues, static_cast<uint8_t>(count));
+        }
     }
 }
 
@@ -892,15 +2169,14 @@ void Parser::while_statement()
     expression();
     consume(TokenType::CloseParen, "Expected ')' after condition.");
     
-    const int exit_jump = emit_jump(Opcode::JumpIfFalse);
-    
-    emit(Opcode::Pop);
+    bool pops_condition;
+    const int exit_jump = emit_condition_jump(pops_condition);
     statement();
     
     emit_loop(loop_start);
     
     patch_jump(exit_jump);
-    emit(Opcode::Pop);
+    if (pops_condition) emit(Opcode::Pop);
 }
 
 void Parser::sync()
@@ -912,9 +2188,12 @@ void Parser::sync()
         
         switch (current.get_type()) {
             case TokenType::Class:
+            case TokenType::Struct:
+            case TokenType::Const:
             case TokenType::Func:
             case TokenType::If:
             case TokenType::While:
+            case TokenType::Switch:
             case TokenType::Print:
             case TokenType::Return:
                 return;
@@ -1,4 +1,5 @@
 #include "runtime/core_vm.h"
+#include "provider/strkernels.h"
 
 #include <cstdarg>
 
@@ -16,18 +17,6 @@ template<class... Ts> struct overloaded : Ts... { using Ts::operator()...; };
 */
 template<class... Ts> overloaded(Ts...) -> overloaded<Ts...>;
 
-[[maybe_unused]] static const std::string operator+(const std::string& str, double num)
-{
-    std::string str_num = std::to_string(num);
-    return str + str_num;
-}
-
-[[maybe_unused]] static const std::string operator+(double num, const std::string& str)
-{
-    std::string str_num = std::to_string(num);
-    return str_num + str;
-}
-
 struct CallVisitor {
     const int arg_count;
     VirtualMachine& vm;
@@ -37,7 +26,19 @@ struct CallVisitor {
 
     bool operator()(const NativeFunc& native) const
     {
+        // Natives only deal with flat strings.
+        for (std::vector<Value>::iterator arg = vm.stack.end() - arg_count; arg != vm.stack.end(); ++arg) {
+            if (const Rope* rope = std::get_if<Rope>(&*arg)) {
+                std::string flat = (*rope)->str();
+                *arg = std::move(flat);
+            }
+        }
+
         Value result = native->function(arg_count, vm.stack.end() - arg_count);
+        if (vm.frames.empty()) {
+            // A call back into the VM raised a runtime error and unwound it.
+            return false;
+        }
         try {
             vm.stack.resize(vm.stack.size() - arg_count - 1);
             vm.stack.reserve(STACK_MAX);
@@ -71,6 +72,22 @@ struct CallVisitor {
         return true;
     }
 
+    bool operator()(const Struct& type) const
+    {
+        const int field_count = static_cast<int>(type->fields.size());
+        if (arg_count > field_count) {
+            vm.runtime_error("Expected at most %d arguments but got %d.", field_count, arg_count);
+            return false;
+        }
+
+        // Fields without an argument start as null.
+        StructInstance record = std::make_shared<StructInstanceObj>(type);
+        std::move(vm.stack.end() - arg_count, vm.stack.end(), record->fields.begin());
+        vm.stack.resize(vm.stack.size() - arg_count);
+        vm.stack.back() = std::move(record);
+        return true;
+    }
+
     bool operator()(const MemberFunc& bound) const
     {
         vm.stack[vm.stack.size() - arg_count - 1] = bound->receiver;
@@ -92,6 +109,17 @@ bool VirtualMachine::call_value(const Value& callee, int arg_count)
 
 bool VirtualMachine::invoke(const std::string& name, int arg_count)
 {
+    if (const StructInstance* record = std::get_if<StructInstance>(&peek(arg_count))) {
+        const int index = (*record)->type->field_index(name);
+        if (index == -1) {
+            runtime_error("Undefined field '%s' in struct %s.", name.c_str(), (*record)->type->name.c_str());
+            return false;
+        }
+        Value value = (*record)->fields[index];
+        stack[stack.size() - arg_count - 1] = value;
+        return call_value(value, arg_count);
+    }
+
     try {
         Instance instance = std::get<Instance>(peek(arg_count));
 
@@ -120,6 +148,200 @@ bool VirtualMachine::invoke_from_class(Class class_value, const std::string& nam
     return call(method, arg_count);
 }
 
+bool VirtualMachine::get_property(const std::string& name)
+{
+    if (const StructInstance* record = std::get_if<StructInstance>(&peek(0))) {
+        const int index = (*record)->type->field_index(name);
+        if (index == -1) {
+            runtime_error("Undefined field '%s' in struct %s.", name.c_str(), (*record)->type->name.c_str());
+            return false;
+        }
+        Value value = (*record)->fields[index];
+        stack.back() = std::move(value);
+        return true;
+    }
+
+    Instance instance;
+    try {
+        instance = std::get<Instance>(peek(0));
+    } catch (const std::bad_variant_access&) {
+        runtime_error("Only instances have properties.");
+        return false;
+    }
+
+    std::unordered_map<std::string, Value>::iterator found = instance->fields.find(name);
+    if (found != instance->fields.end()) {
+        Value value = found->second;
+        pop(); // Instance.
+        push(value);
+        return true;
+    }
+
+    return bind_method(instance->class_value, name);
+}
+
+bool VirtualMachine::set_property(const std::string& name)
+{
+    if (const StructInstance* record = std::get_if<StructInstance>(&peek(1))) {
+        // Structs have a fixed set of fields.
+        const int index = (*record)->type->field_index(name);
+        if (index == -1) {
+            runtime_error("Struct %s has no field '%s'.", (*record)->type->name.c_str(), name.c_str());
+            return false;
+        }
+        (*record)->fields[index] = peek(0);
+    } else {
+        try {
+            Instance instance = std::get<Instance>(peek(1));
+            instance->fields[name] = peek(0);
+        } catch (const std::bad_variant_access&) {
+            runtime_error("Only instances have fields.");
+            return false;
+        }
+    }
+
+    Value value = pop();
+    pop();
+    push(value);
+    return true;
+}
+
+bool VirtualMachine::index_get()
+{
+    if (const TypedArray* array = std::get_if<TypedArray>(&peek(1))) {
+        const double* index = std::get_if<double>(&peek(0));
+        if (index == nullptr) {
+            runtime_error("Index is not a number");
+            return false;
+        }
+        if (*index < 0 || *index >= static_cast<double>((*array)->size())) {
+            runtime_error("Array index out of bounds");
+            return false;
+        }
+
+        const double value = (*array)->get(static_cast<size_t>(*index));
+        stack.pop_back();
+        stack.back() = value;
+        return true;
+    }
+
+    if (std::holds_alternative<Map>(peek(1))) {
+        Value key = pop();
+        Map map = std::get<Map>(pop());
+        const Value* value = MapObj::is_hashable(key) ? map->find(key) : nullptr;
+
+        if (map->is_set) {
+            push(value != nullptr);
+        } else if (value != nullptr) {
+            push(*value);
+        } else {
+            runtime_error("Key not found in map.");
+            return false;
+        }
+        return true;
+    }
+
+    try {
+        size_t index = static_cast<size_t>(std::get<double>(pop()));
+        Array list;
+
+        try {
+            list = std::get<Array>(pop());
+        }
+        catch (const std::bad_variant_access&) {
+            runtime_error("Object is not an array");
+            return false;
+        }
+
+        if (index < 0 || index >= list->size()) {
+            runtime_error("Array index out of bounds");
+            return false;
+        }
+
+        push(list->get(index));
+
+    } catch (const std::bad_variant_access&) {
+        runtime_error("Index is not a number");
+        return false;
+    }
+
+    return true;
+}
+
+bool VirtualMachine::index_set()
+{
+    if (const TypedArray* array = std::get_if<TypedArray>(&peek(2))) {
+        const double* index = std::get_if<double>(&peek(1));
+        const double* item = std::get_if<double>(&peek(0));
+        if (index == nullptr) {
+            runtime_error("Index is not a number");
+            return false;
+        }
+        if (item == nullptr) {
+            runtime_error("Typed arrays can only hold numbers");
+            return false;
+        }
+        if (*index < 0 || *index >= static_cast<double>((*array)->size())) {
+            runtime_error("Array index out of bounds");
+            return false;
+        }
+
+        (*array)->set(static_cast<size_t>(*index), *item);
+        const double value = *item;
+        stack.resize(stack.size() - 2);
+        stack.back() = value;
+        return true;
+    }
+
+    if (std::holds_alternative<Map>(peek(2))) {
+        Value item = pop();
+        Value key = pop();
+        Map map = std::get<Map>(pop());
+
+        if (map->is_set) {
+            runtime_error("Set elements cannot be assigned, use add().");
+            return false;
+        }
+        if (!MapObj::is_hashable(key)) {
+            runtime_error("Map keys must be numbers, strings or booleans.");
+            return false;
+        }
+
+        map->insert(key, item);
+        push(item);
+        return true;
+    }
+
+    try {
+        Value item = pop();
+        size_t index = static_cast<size_t>(std::get<double>(pop()));
+        Array list;
+
+        try {
+            list = std::get<Array>(pop());
+        }
+        catch (std::bad_variant_access&) {
+            runtime_error("Object is not an array");
+            return false;
+        }
+
+        if (index < 0 || index >= list->size()) {
+            runtime_error("Array index out of bounds");
+            return false;
+        }
+
+        list->set(index, item);
+
+        push(item);
+    }
+    catch (const std::bad_variant_access&) {
+        runtime_error("Index is not a number");
+        return false;
+    }
+
+    return true;
+}
+
 bool VirtualMachine::bind_method(Class class_value, const std::string& name)
 {
     std::unordered_map<std::string, Closure>::iterator found = class_value->methods.find(name);
@@ -194,6 +416,16 @@ bool VirtualMachine::call(const Closure& closure, int arg_count)
         return false;
     }
 
+    if (closure->function->lazy != nullptr) {
+        const bool compiled = Parser::compile_lazy(closure->function, [this](const std::string& name) {
+            return library_constants(name);
+        });
+        if (!compiled) {
+            runtime_error("Could not compile function %s.", closure->function->get_name().c_str());
+            return false;
+        }
+    }
+
     frames.emplace_back(CallFrame());
     CallFrame& frame = frames.back();
     frame.ip = 0;
@@ -203,11 +435,21 @@ bool VirtualMachine::call(const Closure& closure, int arg_count)
     return true;
 }
 
+const std::unordered_map<std::string, Value>* VirtualMachine::library_constants(const std::string& name) const
+{
+    auto library = libraries.find(name);
+    return library != libraries.end() ? &library->second->constants : nullptr;
+}
+
 InterpretResult VirtualMachine::interpret(const std::string& source)
 {
-    Parser parser = Parser(source);
+    Parser parser = Parser(source, compile_constants, [this](const std::string& name) {
+        return library_constants(name);
+    });
+    parser.set_lazy_functions(lazy_compilation);
     std::optional<Func> opt = parser.compile();
     if (!opt) { return InterpretResult::CompileError; }
+    compile_constants = parser.get_constants();
 
     Func& function = *opt;
     Closure closure = std::make_shared<ClosureObj>(function);
@@ -217,6 +459,37 @@ InterpretResult VirtualMachine::interpret(const std::string& source)
     return run();
 }
 
+std::optional<Value> VirtualMachine::call_function(const Value& callee, const std::vector<Value>& args)
+{
+    if (frames.empty()) {
+        runtime_error("Functions can only be called back from a running script.");
+        return std::nullopt;
+    }
+
+    // Open upvalues and native arguments point into the stack, so it must
+    // never be reallocated by a nested call.
+    if (stack.size() + args.size() + 1 > STACK_MAX) {
+        runtime_error("Stack overflow.");
+        return std::nullopt;
+    }
+
+    const size_t base_frame = frames.size();
+    push(callee);
+    for (const Value& arg : args)
+        push(arg);
+
+    if (!call_value(peek(static_cast<int>(args.size())), static_cast<int>(args.size()))) {
+        return std::nullopt;
+    }
+
+    // Closures and initializers push a new frame: run it until it returns.
+    if (frames.size() > base_frame && run(base_frame) != InterpretResult::Ok) {
+        return std::nullopt;
+    }
+
+    return pop();
+}
+
 void VirtualMachine::runtime_error(const char* format, ...)
 {
     va_list args;
@@ -248,6 +521,13 @@ void VirtualMachine::define_native(const std::string& name, NativeFn function)
     globals[name] = obj;
 }
 
+void VirtualMachine::define_native(const std::string& name, VMNativeFn function)
+{
+    define_native(name, [this, function](int argc, std::vector<Value>::iterator args) -> Value {
+        return function(*this, argc, args);
+    });
+}
+
 void VirtualMachine::define_native_const(const std::string& name, Value value)
 {
     globals[name] = value;
@@ -268,6 +548,183 @@ bool VirtualMachine::binary_op(F op)
     }
 }
 
+bool VirtualMachine::elementwise_op(ArrayOp op)
+{
+    Value result;
+    if (const char* error = elementwise(op, peek(1), peek(0), result)) {
+        runtime_error("%s", error);
+        return false;
+    }
+
+    double_pop_and_push(result);
+    return true;
+}
+
+static Rope rope_of(Value& operand)
+{
+    if (const Rope* rope = std::get_if<Rope>(&operand)) {
+        return *rope;
+    } else if (std::string* flat = std::get_if<std::string>(&operand)) {
+        // Operands are temporaries, their buffers can be moved into leaves.
+        return std::make_shared<RopeObj>(std::move(*flat));
+    }
+    return std::make_shared<RopeObj>(std::string(std::get<Substring>(operand)->view()));
+}
+
+bool VirtualMachine::concatenate()
+{
+    Value& a = stack[stack.size() - 2];
+    Value& b = stack.back();
+
+    if (!(is_string(a) || std::holds_alternative<double>(a)) ||
+        !(is_string(b) || std::holds_alternative<double>(b))) {
+        runtime_error("Operands must be two numbers or two strings.");
+        return false;
+    }
+
+    // Numbers are formatted straight into the string they are appended to,
+    // otherwise into the operand slot (short enough for no allocation).
+    const double* num_b = std::get_if<double>(&b);
+    std::string* flat_a = std::get_if<std::string>(&a);
+    if (num_b != nullptr && flat_a != nullptr && flat_a->size() < RopeObj::MIN_LENGTH) {
+        append_number(*flat_a, *num_b);
+        pop();
+        return true;
+    }
+
+    char buffer[NUMBER_BUFFER_SIZE];
+    if (const double* num = std::get_if<double>(&a)) a = std::string(buffer, format_number(buffer, *num));
+    if (num_b != nullptr) b = std::string(buffer, format_number(buffer, *num_b));
+
+    // Short strings are cheaper to copy than to link, append in place.
+    flat_a = std::get_if<std::string>(&a);
+    if (!std::holds_alternative<Rope>(a) && !std::holds_alternative<Rope>(b) &&
+        as_string(a).size() + as_string(b).size() < RopeObj::MIN_LENGTH) {
+        if (flat_a != nullptr) {
+            flat_a->append(as_string(b));
+        } else {
+            std::string result(as_string(a));
+            result.append(as_string(b));
+            a = std::move(result);
+        }
+        pop();
+        return true;
+    }
+
+    Rope left = rope_of(a);
+    Rope right = rope_of(b);
+    Rope rope = std::make_shared<RopeObj>(std::move(left), std::move(right));
+    if (rope->is_too_deep()) {
+        rope->str();
+    }
+
+    double_pop_and_push(rope);
+    return true;
+}
+
+void VirtualMachine::interpolate(int count)
+{
+    const std::vector<Value>::iterator parts = stack.end() - count;
+    char buffer[NUMBER_BUFFER_SIZE];
+    size_t length = 0;
+    for (std::vector<Value>::iterator part = parts; part != stack.end(); ++part) {
+        if (const double* number = std::get_if<double>(&*part)) {
+            length += static_cast<size_t>(format_number(buffer, *number) - buffer);
+        } else {
+            if (!is_string(*part)) *part = std::visit(StringVisitor(), *part);
+            length += as_string(*part).size();
+        }
+    }
+
+    // Numbers are formatted in place, the spare room fits the last one.
+    std::string result(length + NUMBER_BUFFER_SIZE, '\0');
+    char* out = result.data();
+    for (std::vector<Value>::iterator part = parts; part != stack.end(); ++part) {
+        if (const double* number = std::get_if<double>(&*part)) {
+            out = format_number(out, *number);
+        } else {
+            const std::string_view str = as_string(*part);
+            out = std::copy(str.begin(), str.end(), out);
+        }
+    }
+    result.resize(length);
+
+    stack.resize(stack.size() - count);
+    push(std::move(result));
+}
+
+bool VirtualMachine::arithmetic(Opcode op)
+{
+    const bool numbers = std::holds_alternative<double>(peek(0)) && std::holds_alternative<double>(peek(1));
+    const bool arrays = !numbers && (is_array_operand(peek(0)) || is_array_operand(peek(1)));
+
+    switch (op) {
+        case Opcode::Add:
+            if (numbers) return binary_op([](double a, double b) -> Value { return a + b; });
+            return arrays ? elementwise_op(ArrayOp::Add) : concatenate();
+        case Opcode::Subtract:
+            if (arrays) return elementwise_op(ArrayOp::Subtract);
+            return binary_op([](double a, double b) -> Value { return a - b; });
+        case Opcode::Multiply:
+            if (arrays) return elementwise_op(ArrayOp::Multiply);
+            return binary_op([](double a, double b) -> Value { return a * b; });
+        case Opcode::Divide:
+            if (arrays) return elementwise_op(ArrayOp::Divide);
+            return binary_op([](double a, double b) -> Value { return a / b; });
+        case Opcode::BwAnd:
+            return binary_op([](int a, int b) -> Value { return static_cast<double>(a & b); });
+        case Opcode::BwOr:
+            return binary_op([](int a, int b) -> Value { return static_cast<double>(a | b); });
+        case Opcode::BwXor:
+            return binary_op([](int a, int b) -> Value { return static_cast<double>(a ^ b); });
+        case Opcode::ShiftLeft:
+            return binary_op([](int a, int b) -> Value { return static_cast<double>(a << b); });
+        case Opcode::ShiftRight:
+            return binary_op([](int a, int b) -> Value { return static_cast<double>(a >> b); });
+        default:
+            runtime_error("Invalid compound assignment.");
+            return false;
+    }
+}
+
+bool VirtualMachine::compound_assign(Value& target, uint8_t mode)
+{
+    const Opcode op = Opcode(mode & ~COMPOUND_POSTFIX);
+    const bool postfix = (mode & COMPOUND_POSTFIX) != 0;
+
+    // Numbers are updated in place.
+    double* number = std::get_if<double>(&target);
+    const double* amount = std::get_if<double>(&stack.back());
+    if (number != nullptr && amount != nullptr) {
+        const double old = *number;
+        switch (op) {
+            case Opcode::Add:       *number += *amount; break;
+            case Opcode::Subtract:  *number -= *amount; break;
+            case Opcode::Multiply:  *number *= *amount; break;
+            case Opcode::Divide:    *number /= *amount; break;
+            default:                number = nullptr; break;
+        }
+        if (number != nullptr) {
+            stack.back() = postfix ? old : *number;
+            return true;
+        }
+    }
+
+    // Anything else goes through the binary operation, like the long form.
+    Value old = target;
+    Value operand = pop();
+    push(old);
+    push(std::move(operand));
+    if (!arithmetic(op)) {
+        return false;
+    }
+    target = peek(0);
+    if (postfix) {
+        stack.back() = std::move(old);
+    }
+    return true;
+}
+
 void VirtualMachine::double_pop_and_push(const Value& v)
 {
     pop();
@@ -275,7 +732,7 @@ void VirtualMachine::double_pop_and_push(const Value& v)
     push(v);
 }
 
-InterpretResult VirtualMachine::run()
+InterpretResult VirtualMachine::run(size_t base_frame)
 {
     std::function<uint8_t()> read_byte = [this]() -> uint8_t {
         return this->frames.back().closure->function->get_code(this->frames.back().ip++);
@@ -312,6 +769,39 @@ InterpretResult VirtualMachine::run()
         } \
     } while (false)
 
+#define ARITHMETIC_OP(op, array_op) \
+    do { \
+        if (!(std::holds_alternative<double>(peek(0)) && std::holds_alternative<double>(peek(1))) && \
+            (is_array_operand(peek(0)) || is_array_operand(peek(1)))) { \
+            if (!elementwise_op(array_op)) { \
+                return InterpretResult::RuntimeError; \
+            } \
+        } else { \
+            BINARY_OP(op); \
+        } \
+    } while (false)
+
+// Fused comparison and branch: jumps when the comparison does not hold.
+// Anything but two numbers goes through the plain comparison and tests
+// the truthiness of its result, exactly like the unfused sequence.
+#define COMPARE_JUMP(op, array_op) \
+    do { \
+        const uint16_t offset = read_short(); \
+        const double* b = std::get_if<double>(&peek(0)); \
+        const double* a = std::get_if<double>(&peek(1)); \
+        bool holds; \
+        if (a != nullptr && b != nullptr) { \
+            holds = *a op *b; \
+            stack.resize(stack.size() - 2); \
+        } else { \
+            ARITHMETIC_OP(op, array_op); \
+            holds = !is_false(pop()); \
+        } \
+        if (!holds) { \
+            frames.back().ip += offset; \
+        } \
+    } while (false)
+
 #define INTEGER_BINARY_OP(op) \
     do { \
         if (!binary_op([](int a, int b) -> Value { return static_cast<double>(a op b); })) { \
@@ -374,50 +864,171 @@ InterpretResult VirtualMachine::run()
             }
             case Opcode::GetUpvalue: {
                 uint8_t slot = read_byte();
-                push(*frames.back().closure->upvalues[slot]->location);
+                const Value& upvalue = frames.back().closure->upvalues[slot];
+                if (const Upvalue* boxed = std::get_if<Upvalue>(&upvalue)) {
+                    push(*(*boxed)->location);
+                } else {
+                    push(upvalue);
+                }
                 break;
             }
             case Opcode::SetUpvalue: {
+                // The compiler only boxes upvalues that are assigned.
                 uint8_t slot = read_byte();
-                *frames.back().closure->upvalues[slot]->location = peek(0);
+                *std::get<Upvalue>(frames.back().closure->upvalues[slot])->location = peek(0);
                 break;
             }
-            case Opcode::GetProperty: {
-                Instance instance;
-
-                try {
-                    instance = std::get<Instance>(peek(0));
-                } catch (const std::bad_variant_access&) {
-                    runtime_error("Only instances have properties.");
+            case Opcode::CompoundLocal: {
+                const uint8_t slot = read_byte();
+                if (!compound_assign(stack[frames.back().stack_offset + slot], read_byte())) {
                     return InterpretResult::RuntimeError;
                 }
-
+                break;
+            }
+            case Opcode::CompoundUpvalue: {
+                const uint8_t slot = read_byte();
+                Value& target = *std::get<Upvalue>(frames.back().closure->upvalues[slot])->location;
+                if (!compound_assign(target, read_byte())) {
+                    return InterpretResult::RuntimeError;
+                }
+                break;
+            }
+            case Opcode::CompoundGlobal: {
                 const std::string& name = read_string();
-                std::unordered_map<std::string, Value>::iterator found = instance->fields.find(name);
+                const uint8_t mode = read_byte();
+                std::unordered_map<std::string, Value>::iterator found = globals.find(name);
+                if (found == globals.end()) {
+                    runtime_error("Undefined variable '%s'.", name.c_str());
+                    return InterpretResult::RuntimeError;
+                }
+                if (!compound_assign(found->second, mode)) {
+                    return InterpretResult::RuntimeError;
+                }
+                break;
+            }
+            case Opcode::CompoundProperty: {
+                const std::string& name = read_string();
+                const uint8_t mode = read_byte();
+
+                // Fields found at once are updated where they are.
+                Value* field = nullptr;
+                if (const Instance* instance = std::get_if<Instance>(&peek(1))) {
+                    std::unordered_map<std::string, Value>::iterator found = (*instance)->fields.find(name);
+                    if (found != (*instance)->fields.end()) {
+                        field = &found->second;
+                    }
+                } else if (const StructInstance* record = std::get_if<StructInstance>(&peek(1))) {
+                    const int index = (*record)->type->field_index(name);
+                    if (index != -1) {
+                        field = &(*record)->fields[index];
+                    }
+                }
+                if (field != nullptr) {
+                    if (!compound_assign(*field, mode)) {
+                        return InterpretResult::RuntimeError;
+                    }
+                    Value result = pop();
+                    stack.back() = std::move(result);
+                    break;
+                }
 
-                if (found != instance->fields.end()) {
-                    Value value = found->second;
-                    pop(); // Instance.
-                    push(value);
+                // Otherwise get, operate and set, reporting errors as they do.
+                Value operand = pop();
+                Value object = peek(0);
+                if (!get_property(name)) {
+                    return InterpretResult::RuntimeError;
+                }
+                Value value = pop();
+                push(std::move(operand));
+                if (!compound_assign(value, mode)) {
+                    return InterpretResult::RuntimeError;
+                }
+                Value result = pop();
+                push(std::move(object));
+                push(std::move(value));
+                if (!set_property(name)) {
+                    return InterpretResult::RuntimeError;
+                }
+                stack.back() = std::move(result);
+                break;
+            }
+            case Opcode::CompoundIndex: {
+                const uint8_t mode = read_byte();
+
+                // Elements of plain arrays skip the generic index operations.
+                const Array* list = std::get_if<Array>(&peek(2));
+                const double* position = std::get_if<double>(&peek(1));
+                if (list != nullptr && position != nullptr && *position >= 0 &&
+                    *position < static_cast<double>((*list)->size())) {
+                    const Array array = *list;
+                    const size_t index = static_cast<size_t>(*position);
+                    Value element = array->get(index);
+                    if (!compound_assign(element, mode)) {
+                        return InterpretResult::RuntimeError;
+                    }
+                    array->set(index, std::move(element));
+                    Value result = pop();
+                    stack.resize(stack.size() - 1);
+                    stack.back() = std::move(result);
                     break;
                 }
 
-                if (!bind_method(instance->class_value, name)) {
+                Value operand = pop();
+                Value object = peek(1);
+                Value index = peek(0);
+                if (!index_get()) {
                     return InterpretResult::RuntimeError;
                 }
+                Value element = pop();
+                push(std::move(operand));
+                if (!compound_assign(element, mode)) {
+                    return InterpretResult::RuntimeError;
+                }
+                Value result = pop();
+                push(std::move(object));
+                push(std::move(index));
+                push(std::move(element));
+                if (!index_set()) {
+                    return InterpretResult::RuntimeError;
+                }
+                stack.back() = std::move(result);
                 break;
             }
-            case Opcode::SetProperty: {
-                try {
-                    Instance instance = std::get<Instance>(peek(1));
-                    const std::string& name = read_string();
-                    instance->fields[name] = peek(0);
+            case Opcode::GetProperty:
+                if (!get_property(read_string())) {
+                    return InterpretResult::RuntimeError;
+                }
+                break;
+            case Opcode::SetProperty:
+                if (!set_property(read_string())) {
+                    return InterpretResult::RuntimeError;
+                }
+                break;
+            case Opcode::GetField: {
+                const Struct& type = std::get<Struct>(read_constant());
+                const uint8_t field = read_byte();
+
+                // The slot holds if the receiver is of the struct the compiler saw,
+                // anything else looks the field up by name.
+                const StructInstance* record = std::get_if<StructInstance>(&peek(0));
+                if (record != nullptr && (*record)->type == type) {
+                    Value value = (*record)->fields[field];
+                    stack.back() = std::move(value);
+                } else if (!get_property(type->fields[field])) {
+                    return InterpretResult::RuntimeError;
+                }
+                break;
+            }
+            case Opcode::SetField: {
+                const Struct& type = std::get<Struct>(read_constant());
+                const uint8_t field = read_byte();
 
+                const StructInstance* record = std::get_if<StructInstance>(&peek(1));
+                if (record != nullptr && (*record)->type == type) {
+                    (*record)->fields[field] = peek(0);
                     Value value = pop();
-                    pop();
-                    push(value);
-                } catch (const std::bad_variant_access&) {
-                    runtime_error("Only instances have fields.");
+                    stack.back() = std::move(value);
+                } else if (!set_property(type->fields[field])) {
                     return InterpretResult::RuntimeError;
                 }
                 break;
@@ -432,52 +1043,35 @@ InterpretResult VirtualMachine::run()
                 break;
             }
             case Opcode::Equal: {
-                double_pop_and_push(peek(0) == peek(1));
+                double_pop_and_push(values_equal(peek(0), peek(1)));
                 break;
             }
 
-            case Opcode::Greater:   BINARY_OP(>); break;
-            case Opcode::Less:      BINARY_OP(<); break;
+            case Opcode::NotEqual: {
+                double_pop_and_push(!values_equal(peek(0), peek(1)));
+                break;
+            }
 
-            case Opcode::Add: {
-                bool success = std::visit(overloaded {
-                    [this](double b, double a) -> bool {
-                        this->double_pop_and_push(a + b);
-                        return true;
-                    },
-                    [this](std::string b, std::string a) -> bool {
-                        this->double_pop_and_push(a + b);
-                        return true;
-                    },
-					[this](std::string a, double b) -> bool {
-						std::string bstr = std::to_string(b);
-                        bstr.erase(bstr.find_last_not_of('0') + 1, std::string::npos);
-                        bstr.erase(bstr.find_last_not_of('.') + 1, std::string::npos);
-						this->double_pop_and_push(bstr + a);
-						return true;
-					},
-					[this](double a, std::string b) -> bool {
-						std::string astr = std::to_string(a);
-                        astr.erase(astr.find_last_not_of('0') + 1, std::string::npos);
-                        astr.erase(astr.find_last_not_of('.') + 1, std::string::npos);
-						this->double_pop_and_push(b + astr);
-						return true;
-					},
-                    [this](auto a, auto b) -> bool {
-                        this->runtime_error("Operands must be two numbers or two strings.");
-                        return false;
-                    }
-                }, peek(0), peek(1));
+            case Opcode::Greater:       ARITHMETIC_OP(>, ArrayOp::Greater); break;
+            case Opcode::Less:          ARITHMETIC_OP(<, ArrayOp::Less); break;
+            case Opcode::GreaterEqual:  ARITHMETIC_OP(>=, ArrayOp::GreaterEqual); break;
+            case Opcode::LessEqual:     ARITHMETIC_OP(<=, ArrayOp::LessEqual); break;
 
-                if (!success)
+            case Opcode::Add: {
+                if (std::holds_alternative<double>(peek(0)) && std::holds_alternative<double>(peek(1))) {
+                    BINARY_OP(+);
+                } else if (is_array_operand(peek(0)) || is_array_operand(peek(1))) {
+                    if (!elementwise_op(ArrayOp::Add))
+                        return InterpretResult::RuntimeError;
+                } else if (!concatenate()) {
                     return InterpretResult::RuntimeError;
-
+                }
                 break;
             }
 
-            case Opcode::Subtract:  BINARY_OP(-); break;
-            case Opcode::Multiply:  BINARY_OP(*); break;
-            case Opcode::Divide:    BINARY_OP(/); break;
+            case Opcode::Subtract:  ARITHMETIC_OP(-, ArrayOp::Subtract); break;
+            case Opcode::Multiply:  ARITHMETIC_OP(*, ArrayOp::Multiply); break;
+            case Opcode::Divide:    ARITHMETIC_OP(/, ArrayOp::Divide); break;
             case Opcode::BwAnd:    INTEGER_BINARY_OP(&); break;
             case Opcode::BwOr:     INTEGER_BINARY_OP(|); break;
             case Opcode::BwXor:    INTEGER_BINARY_OP(^); break;
@@ -519,12 +1113,143 @@ InterpretResult VirtualMachine::run()
                 break;
             }
 
+            case Opcode::JumpTable: {
+                // Integer cases from low, the distances go back to the bodies.
+                const double low = std::get<double>(read_constant());
+                const uint16_t size = read_short();
+                uint16_t distance = read_short();
+                const size_t table = frames.back().ip;
+                frames.back().ip += 2 * size;
+
+                if (const double* number = std::get_if<double>(&peek(0))) {
+                    const double index = *number - low;
+                    if (index >= 0 && index < size && index == std::floor(index)) {
+                        const Func& function = frames.back().closure->function;
+                        const size_t entry = table + 2 * static_cast<size_t>(index);
+                        distance = static_cast<uint16_t>((function->get_code(entry) << 8) | function->get_code(entry + 1));
+                    }
+                }
+                stack.pop_back();
+                frames.back().ip -= distance;
+                break;
+            }
+
+            case Opcode::SwitchMap: {
+                const Map& table = std::get<Map>(read_constant());
+                const uint16_t fallback = read_short();
+                const Value* distance = MapObj::is_hashable(peek(0)) ? table->find(peek(0)) : nullptr;
+                stack.pop_back();
+                frames.back().ip -= distance != nullptr ? static_cast<size_t>(std::get<double>(*distance)) : fallback;
+                break;
+            }
+
+            case Opcode::Interpolate:
+                interpolate(read_byte());
+                break;
+
             case Opcode::Loop: {
                 uint16_t offset = read_short();
                 frames.back().ip -= offset;
                 break;
             }
 
+            case Opcode::JumpIfNotEqual:
+            case Opcode::JumpIfEqual: {
+                const uint16_t offset = read_short();
+                const bool equal = values_equal(peek(0), peek(1));
+                stack.resize(stack.size() - 2);
+                if (equal == (instruction == Opcode::JumpIfEqual)) {
+                    frames.back().ip += offset;
+                }
+                break;
+            }
+
+            case Opcode::JumpIfNotGreater:      COMPARE_JUMP(>, ArrayOp::Greater); break;
+            case Opcode::JumpIfNotGreaterEqual: COMPARE_JUMP(>=, ArrayOp::GreaterEqual); break;
+            case Opcode::JumpIfNotLess:         COMPARE_JUMP(<, ArrayOp::Less); break;
+            case Opcode::JumpIfNotLessEqual:    COMPARE_JUMP(<=, ArrayOp::LessEqual); break;
+
+            case Opcode::ForPrep: {
+                Value* slots = &stack[frames.back().stack_offset + read_byte()];
+                const uint16_t offset = read_short();
+
+                const double* index = std::get_if<double>(&slots[0]);
+                const double* limit = std::get_if<double>(&slots[1]);
+                const double* step = std::get_if<double>(&slots[2]);
+                if (index == nullptr || limit == nullptr || step == nullptr) {
+                    runtime_error("Range bounds and step must be numbers.");
+                    return InterpretResult::RuntimeError;
+                }
+                if (*step == 0) {
+                    runtime_error("Range step cannot be zero.");
+                    return InterpretResult::RuntimeError;
+                }
+
+                if (*step > 0 ? *index < *limit : *index > *limit) {
+                    slots[3] = *index;
+                } else {
+                    frames.back().ip += offset;
+                }
+                break;
+            }
+
+            case Opcode::ForLoop: {
+                // ForPrep checked the slots, nothing else can write them.
+                Value* slots = &stack[frames.back().stack_offset + read_byte()];
+                const uint16_t offset = read_short();
+
+                double& index = *std::get_if<double>(&slots[0]);
+                const double limit = *std::get_if<double>(&slots[1]);
+                const double step = *std::get_if<double>(&slots[2]);
+                index += step;
+                if (step > 0 ? index < limit : index > limit) {
+                    slots[3] = index;
+                    frames.back().ip -= offset;
+                }
+                break;
+            }
+
+            case Opcode::IterNext: {
+                // The size is read on each step: elements added in the body are
+                // reached, removing elements ends the loop early.
+                Value* slots = &stack[frames.back().stack_offset + read_byte()];
+                const uint16_t offset = read_short();
+
+                double& position = *std::get_if<double>(&slots[1]);
+                size_t next = static_cast<size_t>(position);
+                bool has_next;
+                if (const Array* array = std::get_if<Array>(&slots[0])) {
+                    has_next = next < (*array)->size();
+                    if (has_next) slots[2] = (*array)->get(next++);
+                } else if (const TypedArray* typed = std::get_if<TypedArray>(&slots[0])) {
+                    has_next = next < (*typed)->size();
+                    if (has_next) slots[2] = (*typed)->get(next++);
+                } else if (const Map* map = std::get_if<Map>(&slots[0])) {
+                    const MapObj::Entry* entry = (*map)->next(next);
+                    has_next = entry != nullptr;
+                    if (has_next) slots[2] = entry->key;
+                } else if (is_string(slots[0])) {
+                    // One code point at a time, ASCII bytes on their own.
+                    const std::string_view chars = as_string(slots[0]);
+                    has_next = next < chars.size();
+                    if (has_next) {
+                        const size_t length = static_cast<unsigned char>(chars[next]) < 0x80
+                            ? 1 : stdlib::kernels::sequence_length(chars, next);
+                        slots[2] = std::string(chars.substr(next, length));
+                        next += length;
+                    }
+                } else {
+                    runtime_error("Can only iterate over arrays, typed arrays, maps and strings.");
+                    return InterpretResult::RuntimeError;
+                }
+
+                if (has_next) {
+                    position = static_cast<double>(next);
+                    frames.back().ip -= offset;
+                }
+                break;
+            }
+
             case Opcode::JumpIfFalse: {
                 uint16_t offset = read_short();
                 if (is_false(peek(0))) {
@@ -541,6 +1266,60 @@ InterpretResult VirtualMachine::run()
                 break;
             }
 
+            case Opcode::InlineCall: {
+                // The inlined body follows unless the callee changed since.
+                const uint8_t arg_count = read_byte();
+                const Func& function = std::get<Func>(read_constant());
+                const uint16_t skip = read_short();
+                const Closure* closure = std::get_if<Closure>(&peek(arg_count));
+                if (closure == nullptr || (*closure)->function != function) {
+                    frames.back().ip += skip;
+                    if (!call_value(peek(arg_count), arg_count)) {
+                        return InterpretResult::RuntimeError;
+                    }
+                }
+                break;
+            }
+
+            case Opcode::InlineInvoke: {
+                const std::string& method = read_string();
+                const uint8_t arg_count = read_byte();
+                const Func& function = std::get<Func>(read_constant());
+                const uint16_t skip = read_short();
+                bool inlined = false;
+                if (const Instance* instance = std::get_if<Instance>(&peek(arg_count))) {
+                    const auto& methods = (*instance)->class_value->methods;
+                    const auto found = methods.find(method);
+                    inlined = found != methods.end() && found->second->function == function
+                              && (*instance)->fields.find(method) == (*instance)->fields.end();
+                }
+                if (!inlined) {
+                    frames.back().ip += skip;
+                    if (!invoke(method, arg_count)) {
+                        return InterpretResult::RuntimeError;
+                    }
+                }
+                break;
+            }
+
+            case Opcode::GetSlot:
+                push(peek(read_byte()));
+                break;
+
+            case Opcode::SetSlot: {
+                const uint8_t distance = read_byte();
+                stack[stack.size() - 1 - distance] = peek(0);
+                break;
+            }
+
+            case Opcode::InlineEnd: {
+                // Keep the result in place of the callee and its locals.
+                const uint8_t count = read_byte();
+                stack[stack.size() - 1 - count] = std::move(stack.back());
+                stack.resize(stack.size() - count);
+                break;
+            }
+
             case Opcode::Invoke: {
                 const std::string& method = read_string();
                 int arg_count = read_byte();
@@ -565,12 +1344,18 @@ InterpretResult VirtualMachine::run()
                 Closure closure = std::make_shared<ClosureObj>(function);
                 push(closure);
                 for (int i = 0; i < static_cast<int>(closure->upvalues.size()); i++) {
-                    uint8_t is_local = read_byte();
+                    CaptureKind kind = CaptureKind(read_byte());
                     uint8_t index = read_byte();
-                    if (is_local) {
-                        closure->upvalues[i] = capture_upvalue(&stack[frames.back().stack_offset + index]);
-                    } else {
-                        closure->upvalues[i] = frames.back().closure->upvalues[index];
+                    switch (kind) {
+                        case CaptureKind::Value:
+                            closure->upvalues[i] = stack[frames.back().stack_offset + index];
+                            break;
+                        case CaptureKind::Boxed:
+                            closure->upvalues[i] = capture_upvalue(&stack[frames.back().stack_offset + index]);
+                            break;
+                        case CaptureKind::Upvalue:
+                            closure->upvalues[i] = frames.back().closure->upvalues[index];
+                            break;
                     }
                 }
                 break;
@@ -595,18 +1380,80 @@ InterpretResult VirtualMachine::run()
                 stack.resize(last_offset);
                 stack.reserve(STACK_MAX);
                 push(result);
+
+                // Returning into the native that called us.
+                if (frames.size() == base_frame) {
+                    return InterpretResult::Ok;
+                }
+                break;
+            }
+
+            case Opcode::ReturnValues: {
+                const uint8_t count = read_byte();
+                close_upvalues(&stack[frames.back().stack_offset]);
+
+                size_t last_offset = frames.back().stack_offset;
+                const size_t first_value = stack.size() - count;
+                frames.pop_back();
+
+                // A caller returning the call right away passes all the
+                // values on. The script itself never returns.
+                while (frames.size() > std::max<size_t>(base_frame, 1)) {
+                    CallFrame& caller = frames.back();
+                    if (Opcode(caller.closure->function->get_code(caller.ip)) != Opcode::Return) break;
+                    close_upvalues(&stack[caller.stack_offset]);
+                    last_offset = caller.stack_offset;
+                    frames.pop_back();
+                }
+
+                // A caller going on with Unpack takes as many values as it
+                // names, any other caller takes the first one.
+                size_t wanted = 1;
+                if (frames.size() > base_frame) {
+                    CallFrame& caller = frames.back();
+                    const Func& function = caller.closure->function;
+                    if (Opcode(function->get_code(caller.ip)) == Opcode::Unpack) {
+                        wanted = function->get_code(caller.ip + 1);
+                        caller.ip += 2;
+                    }
+                }
+
+                const size_t kept = std::min<size_t>(count, wanted);
+                std::move(stack.begin() + first_value, stack.begin() + first_value + kept, stack.begin() + last_offset);
+                stack.resize(last_offset + kept);
+                stack.resize(last_offset + wanted, std::monostate());
+
+                // Returning into the native that called us.
+                if (frames.size() == base_frame) {
+                    return InterpretResult::Ok;
+                }
+                break;
+            }
+
+            case Opcode::Unpack: {
+                // Values other than multiple return values: arrays spread,
+                // any other value comes first and null for the rest.
+                const uint8_t count = read_byte();
+                Value value = pop();
+                if (const Array* array = std::get_if<Array>(&value)) {
+                    for (size_t i = 0; i < count; ++i) {
+                        push(i < (*array)->size() ? (*array)->get(i) : Value(std::monostate()));
+                    }
+                } else if (const TypedArray* typed = std::get_if<TypedArray>(&value)) {
+                    for (size_t i = 0; i < count; ++i) {
+                        push(i < (*typed)->size() ? Value((*typed)->get(i)) : Value(std::monostate()));
+                    }
+                } else {
+                    push(std::move(value));
+                    stack.resize(stack.size() + count - 1, std::monostate());
+                }
                 break;
             }
 
             case Opcode::ArrBuild: {
-                Array new_arr = std::make_shared<ArrayObj>();
                 uint8_t item_count = read_byte();
-
-				push(new_arr);
-				for (int i = item_count; i > 0; i--) {
-					new_arr->values.push_back(peek(i));
-            	}
-				pop();
+                Array new_arr = std::make_shared<ArrayObj>(
+                    ArrayObj::Storage(stack.end() - item_count, stack.end()));
 
 				while (item_count-- > 0) {
 					pop();
@@ -616,65 +1463,56 @@ InterpretResult VirtualMachine::run()
 				break;
 			}
 
-            case Opcode::ArrIndex: {
-                try {
-                    size_t index = static_cast<size_t>(std::get<double>(pop()));
-                    Array list;
-
-                    try {
-                        list = std::get<Array>(pop());
-                    }
-                    catch (const std::bad_variant_access&) {
-                        runtime_error("Object is not an array");
-                        return InterpretResult::RuntimeError;
-                    }
-
-                    if (index < 0 || index >= list->values.size()) {
-                        runtime_error("Array index out of bounds");
-                        return InterpretResult::RuntimeError;
-                    }
-
-                    Value& result = list->values[index];
-                    push(result);
-
-                } catch (const std::bad_variant_access&) {
-                    runtime_error("Index is not a number");
-                    return InterpretResult::RuntimeError;
-                }
+            case Opcode::ArrClone:
+                // The copy shares the template until it is written.
+                push(ArrayObj::copy(frames.back().closure->function->get_template(read_short())));
+                break;
 
+            case Opcode::ArrExtend: {
+                const Array& pattern = frames.back().closure->function->get_template(read_short());
+                ArrayObj::Storage& values = std::get<Array>(peek(0))->resizable();
+                values.insert(values.end(), pattern->begin(), pattern->end());
                 break;
             }
 
-            case Opcode::ArrStore: {
-                try {
-                    Value item = pop();
-                    size_t index = static_cast<size_t>(std::get<double>(pop()));
-                    Array list;
+            case Opcode::ArrAppend: {
+                uint8_t item_count = read_byte();
+                const auto first = stack.end() - item_count;
+                ArrayObj::Storage& values = std::get<Array>(*(first - 1))->resizable();
+                values.insert(values.end(), std::make_move_iterator(first), std::make_move_iterator(stack.end()));
+                stack.erase(first, stack.end());
+                break;
+            }
 
-                    try {
-                        list = std::get<Array>(pop());
-                    }
-                    catch (std::bad_variant_access&) {
-                        runtime_error("Object is not an array");
-                        return InterpretResult::RuntimeError;
-                    }
+            case Opcode::MapBuild: {
+                uint8_t entry_count = read_byte();
+                Map map = std::make_shared<MapObj>();
 
-                    if (index < 0 || index >= list->values.size()) {
-                        runtime_error("Array index out of bounds");
+                const size_t first = stack.size() - 2 * static_cast<size_t>(entry_count);
+                for (size_t i = first; i < stack.size(); i += 2) {
+                    if (!MapObj::is_hashable(stack[i])) {
+                        runtime_error("Map keys must be numbers, strings or booleans.");
                         return InterpretResult::RuntimeError;
                     }
+                    map->insert(stack[i], stack[i + 1]);
+                }
+                stack.erase(stack.begin() + first, stack.end());
 
-                    list->values[index] = item;
+                push(map);
+                break;
+            }
 
-                    push(item);
-                }
-                catch (const std::bad_variant_access&) {
-                    runtime_error("Index is not a number");
+            case Opcode::ArrIndex:
+                if (!index_get()) {
                     return InterpretResult::RuntimeError;
                 }
+                break;
 
+            case Opcode::ArrStore:
+                if (!index_set()) {
+                    return InterpretResult::RuntimeError;
+                }
                 break;
-            }
 
             case Opcode::Class:
                 push(std::make_shared<ClassObj>(read_string()));
@@ -3,6 +3,7 @@
 
 // Standard C++ headers.
 #include <string>
+#include <vector>
 
 /**
  * @brief Describes the type of a Token.
@@ -39,7 +40,31 @@ enum class TokenType {
     OpenSquare, CloseSquare,
 
     // Bitwise shifts
-    GreaterGreater, LessLess
+    GreaterGreater, LessLess,
+
+    // Map literal entries
+    Colon,
+
+    // Struct declarations
+    Struct,
+
+    // Constant declarations
+    Const,
+
+    // Range for loops
+    In, DotDot,
+
+    // Compound assignments
+    PlusEqual, MinusEqual, StarEqual, SlashEqual,
+    BwAndEqual, BwOrEqual, BwXorEqual,
+    LessLessEqual, GreaterGreaterEqual,
+    PlusPlus, MinusMinus,
+
+    // Switch statements
+    Switch, Case, Default,
+
+    // Template strings: text up to a '${' and text up to the closing '`'
+    TemplatePart, Template
 };
 
 /**
@@ -98,9 +123,10 @@ public:
     /**
      * @brief Create a new Tokenizer.
      * @param source Source code to tokenize.
+     * @param line Line number of the start of the source.
     */
-    explicit Tokenizer(const std::string& source)
-        : source(source), start(0u), current(0u), line(1) {}
+    explicit Tokenizer(const std::string& source, int line = 1)
+        : source(source), start(0u), current(0u), line(line) {}
     
     /**
      * @brief Scan the next token.
@@ -108,6 +134,26 @@ public:
     */
     Token scan_token();
 
+    /**
+     * @brief Scan a token ahead without consuming anything.
+     * @param skip Number of tokens to skip before the one returned.
+     * @return Scanned token.
+    */
+    Token peek_token(int skip = 0);
+
+    /**
+     * @brief Scan past a block whose '{' was just scanned, matching braces
+     * only.
+     * @return The closing '}', or Eof if the block is not closed.
+    */
+    Token skip_block();
+
+    /**
+     * @brief Get the whole source code, from its start.
+     * @return Source code of this tokenizer.
+    */
+    const std::string& get_source() const { return source; }
+
 private:
     /**
      * @brief Source code.
@@ -193,6 +239,18 @@ private:
      * @brief Tokenize a string.
     */
     Token string_(const char open_char = '"');
+
+    /**
+     * @brief Tokenize the text of a template string, after the opening '`'
+     * or the '}' closing an interpolated expression.
+    */
+    Token template_();
+
+    /**
+     * @brief Curly braces open in each interpolated expression being
+     * scanned, the innermost last.
+    */
+    std::vector<int> template_braces;
 };
 
 #endif /* scanner_hpp */
@@ -9,6 +9,14 @@ struct EArray : public ELibrary {
 	EArray();
 };
 
+/**
+ * @brief min(arr), max(arr) and sum(arr) over an array or typed array of
+ * numbers. The math library's variadic versions forward single arrays here.
+*/
+Value array_min(int argc, std::vector<Value>::iterator args);
+Value array_max(int argc, std::vector<Value>::iterator args);
+Value array_sum(int argc, std::vector<Value>::iterator args);
+
 }
 
 #endif
\ No newline at end of file
@@ -19,6 +19,9 @@ namespace stdlib {
 		// Library static constant values
 		const std::unordered_map<std::string, Value> constants;
 
+		// Library functions that call back into the virtual machine
+		const std::unordered_map<std::string, VMNativeFn> vm_functions;
+
 		/**
 		 * @brief Creates a new standard library function group.
 		 * @param functions: functions to be included in this library.
@@ -26,7 +29,18 @@ namespace stdlib {
 		*/
 		ELibrary(const std::unordered_map<std::string, NativeFn>& functions,
 				 const std::unordered_map<std::string, Value>& constants)
-		: functions(functions), constants(constants) {};
+		: functions(functions), constants(constants), vm_functions() {};
+
+		/**
+		 * @brief Creates a new standard library function group.
+		 * @param functions: functions to be included in this library.
+		 * @param vm_functions: functions that need access to the virtual machine.
+		 * @param constants: constants to be included in this library.
+		*/
+		ELibrary(const std::unordered_map<std::string, NativeFn>& functions,
+				 const std::unordered_map<std::string, VMNativeFn>& vm_functions,
+				 const std::unordered_map<std::string, Value>& constants)
+		: functions(functions), constants(constants), vm_functions(vm_functions) {};
 	};
 }
 
@@ -0,0 +1,14 @@
+#ifndef ELY_RT_EMAP_H
+#define ELY_RT_EMAP_H
+
+#include "elibrary.h"
+
+namespace stdlib {
+
+struct EMap : public ELibrary {
+	EMap();
+};
+
+}
+
+#endif
@@ -0,0 +1,32 @@
+#ifndef ELY_RT_ESTRING_H
+#define ELY_RT_ESTRING_H
+
+#include "elibrary.h"
+
+namespace stdlib {
+
+/**
+ * @brief String manipulation library. Pieces cut out of long strings
+ * are substring views sharing the original buffer. Code point functions
+ * (ulen, ucharAt, ...) rescan plain strings on every call; utf8(str)
+ * returns a view that keeps its encoding and code point index instead.
+*/
+struct EString : public ELibrary {
+	EString();
+};
+
+/**
+ * @brief slice(str, begin, [end]), with negative indices counted from the
+ * end. Always available through the array library's slice.
+*/
+Value string_slice(int argc, std::vector<Value>::iterator args);
+
+/**
+ * @brief find(str, needle, [from]): byte offset of needle, or -1. Always
+ * available through the array library's indexOf.
+*/
+Value string_find(int argc, std::vector<Value>::iterator args);
+
+}
+
+#endif
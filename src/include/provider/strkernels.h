@@ -0,0 +1,62 @@
+#ifndef ELY_RT_STRKERNELS_H
+#define ELY_RT_STRKERNELS_H
+
+#include "runtime/value.h"
+
+#include <string_view>
+#include <cstddef>
+
+namespace stdlib::kernels {
+
+/**
+ * @brief Find the first occurrence of needle in haystack, starting at
+ * offset from.
+ * @return Byte offset of the match, std::string_view::npos if none.
+*/
+size_t find(std::string_view haystack, std::string_view needle, size_t from = 0);
+
+/**
+ * @brief Count the non-overlapping occurrences of needle in haystack.
+*/
+size_t count(std::string_view haystack, std::string_view needle);
+
+/**
+ * @brief Convert ASCII letters to upper case in place, other bytes are kept.
+*/
+void to_upper(char* data, size_t length);
+
+/**
+ * @brief Convert ASCII letters to lower case in place, other bytes are kept.
+*/
+void to_lower(char* data, size_t length);
+
+/**
+ * @brief Length of the leading run of ASCII bytes.
+*/
+size_t ascii_prefix(std::string_view text);
+
+/**
+ * @brief Number of code points in valid UTF-8 text.
+*/
+size_t count_code_points(std::string_view text);
+
+/**
+ * @brief Byte length of the code point starting at offset: the byte and
+ * the continuation bytes after it.
+*/
+size_t sequence_length(std::string_view text, size_t offset);
+
+/**
+ * @brief Validate text as UTF-8, rejecting overlong forms, surrogates and
+ * code points past U+10FFFF. Never returns TextEncoding::Unknown.
+*/
+TextEncoding classify(std::string_view text);
+
+/**
+ * @brief Name of the kernel set selected for this CPU ("avx2", "sse2" or "scalar").
+*/
+const char* instruction_set();
+
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef ELY_RT_ARRAY_OPS_H
+#define ELY_RT_ARRAY_OPS_H
+
+// Elysabettian headers.
+#include "runtime/value.h"
+
+/**
+ * @brief Element-wise operations between arrays, typed arrays and numbers.
+*/
+enum class ArrayOp : uint8_t {
+    Add, Subtract, Multiply, Divide,
+    Greater, Less,
+    GreaterEqual, LessEqual
+};
+
+struct TypedArrayObj;
+
+/**
+ * @brief A number, array of numbers or typed array seen as doubles: numbers
+ * and f64 typed arrays are used in place, other arrays are converted into
+ * the buffer.
+*/
+struct NumericView {
+    const double* data = nullptr;
+    size_t size = 0;
+    bool scalar = false;
+    const TypedArrayObj* typed = nullptr;
+    std::vector<double> buffer;
+};
+
+/**
+ * @brief Fill a numeric view of a value. The value must outlive the view.
+ * @return Error message, nullptr on success.
+*/
+const char* view_numbers(const Value& value, NumericView& view);
+
+/**
+ * @brief Reductions over doubles, vectorized.
+*/
+double sum(const double* data, size_t size);
+double minimum(const double* data, size_t size);
+double maximum(const double* data, size_t size);
+
+/**
+ * @brief Check whether a value takes part in element-wise operations.
+*/
+bool is_array_operand(const Value& value);
+
+/**
+ * @brief Apply an operation element by element. Either operand may be a
+ * number, which is broadcast over the other one; two arrays must have the
+ * same length.
+ *
+ * Plain arrays (of numbers) give a plain array, of booleans for the
+ * comparisons. As soon as a typed array takes part the result is typed:
+ * u8 (0 or 1) for the comparisons, otherwise the common element kind of the
+ * typed operands when the result stays integral (no division, integral
+ * scalars) and f64 in every other case. Integer results are computed in
+ * double precision and then stored.
+ *
+ * @param result Receives the result.
+ * @return Error message, nullptr on success.
+*/
+const char* elementwise(ArrayOp op, const Value& a, const Value& b, Value& result);
+
+#endif
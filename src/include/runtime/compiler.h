@@ -12,6 +12,8 @@
 #include <cstddef>
 #include <array>
 #include <functional>
+#include <unordered_map>
+#include <unordered_set>
 
 /**
  * @brief Describes the types of precedences used during
@@ -60,8 +62,60 @@ struct LocalVar {
     std::string name;
     int depth;
     bool is_captured;
+    bool is_assigned;
+    /**
+     * @brief Offsets of the Opcode::Closure capture operands referring to
+     * this local, patched once the whole scope of the local is known.
+    */
+    std::vector<int> capture_sites;
     LocalVar(const std::string& name, int depth)
-        : name(name), depth(depth), is_captured{false_value} {};
+        : name(name), depth(depth), is_captured{false_value}, is_assigned{false_value} {};
+};
+
+/**
+ * @brief Holds a constant declared inside a block. Constants live only in
+ * the compiler, their uses are replaced by the value.
+*/
+struct ConstVar {
+    std::string name;
+    Value value;
+    int depth;
+};
+
+/**
+ * @brief A load of a value known at compile time, [start, end) in the
+ * code of the function.
+*/
+struct ConstantLoad {
+    int start;
+    int end;
+    Value value;
+};
+
+/**
+ * @brief Looks up the constants of a library by name, nullptr if there is
+ * no such library.
+*/
+using LibraryConstants = std::function<const std::unordered_map<std::string, Value>*(const std::string&)>;
+
+/**
+ * @brief What the compiler knew at the end of a script, shared by the
+ * functions of the script compiled on their first call.
+*/
+struct LazyScope {
+    std::vector<Struct> struct_types;
+    std::unordered_map<std::string, Func> inline_methods;
+};
+
+/**
+ * @brief Parameters and body of a top level function, compiled on its first
+ * call. The constants are those visible at the declaration.
+*/
+struct LazyFunction {
+    std::string source;
+    int line;
+    std::shared_ptr<const std::unordered_map<std::string, Value>> constants;
+    std::shared_ptr<LazyScope> scope;
 };
 
 /**
@@ -111,10 +165,18 @@ public:
     */
     void declare_variable(const std::string& name);
 
+    /**
+     * @brief Report a variable or constant of the same name declared in the
+     * current scope.
+     * @param name Name being declared.
+    */
+    void check_redeclaration(const std::string& name);
+
     /**
      * @brief Mark a variable statement as already initialized.
+     * @param count Number of variables declared last to mark.
     */
-    void mark_initialized();
+    void mark_initialized(size_t count = 1);
 
     /**
      * @brief Resolve (find) a local value by name.
@@ -130,6 +192,15 @@ public:
     */
     int resolve_upvalue(const std::string& name);
 
+    /**
+     * @brief Resolve a constant by name: the ones declared in the blocks of
+     * this function, then those of the enclosing functions and the top
+     * level ones. Local variables of the same name hide them.
+     * @param name Name of the constant to find.
+     * @return Value of the constant, nullptr if the name is not a constant.
+    */
+    const Value* resolve_constant(std::string_view name) const;
+
     /**
      * @brief Add a new upvalue.
      * @param index Index of the new upvalue.
@@ -138,6 +209,19 @@ public:
     */
     int add_upvalue(uint8_t index, bool is_local);
 
+    /**
+     * @brief Mark the variable behind an upvalue as reassigned.
+     * @param index Index of the upvalue being assigned.
+    */
+    void mark_upvalue_assigned(int index);
+
+    /**
+     * @brief Decide how closures capture a local that goes out of scope:
+     * by value if it is never reassigned, boxed otherwise.
+     * @param local Local variable leaving its scope.
+    */
+    void resolve_captures(const LocalVar& local);
+
     /**
      * @brief Begin a new scope.
     */
@@ -192,6 +276,36 @@ private:
     */
     std::vector<UpvalueVar> upvalues;
 
+    /**
+     * @brief Constants declared in the blocks of this function.
+    */
+    std::vector<ConstVar> constants;
+
+    /**
+     * @brief Loads of known values since the last jump target, the
+     * operands constant folding looks at.
+    */
+    std::vector<ConstantLoad> constant_loads;
+
+    /**
+     * @brief Offset of the last comparison instruction, -1 once a jump
+     * target follows it. A condition ending there can branch on it directly.
+    */
+    int last_comparison = -1;
+
+    /**
+     * @brief Name of the last global loaded and the offset after the
+     * load, a call right there may be inlined.
+    */
+    std::string last_global;
+    int last_global_end = -1;
+
+    /**
+     * @brief Set while compiling the values of a multiple variable
+     * declaration, whose calls are not inlined.
+    */
+    bool unpacking = false;
+
     /**
      * @brief Depth of the current scope.
     */
@@ -224,8 +338,15 @@ public:
     /**
      * @brief Create a new parser to parse the provided source code.
      * @param source Source code as string.
+     * @param constants Top level constants of the code compiled before.
+     * @param library_constants Constants of the libraries, made known by
+     * the imports in the source.
+     * @param line Line number of the start of the source.
     */
-    explicit Parser(const std::string& source);
+    explicit Parser(const std::string& source,
+                    std::unordered_map<std::string, Value> constants = {},
+                    LibraryConstants library_constants = nullptr,
+                    int line = 1);
 
     /**
      * @brief Get the current code chunk.
@@ -242,11 +363,42 @@ public:
     */
     std::optional<Func> compile();
 
+    /**
+     * @brief Top level constants, the ones given at construction and those
+     * declared by the source. Library constants are left out, a later
+     * source may reuse their names.
+    */
+    std::unordered_map<std::string, Value> get_constants() const;
+
+    /**
+     * @brief Leave the bodies of top level functions to be compiled on their
+     * first call, by compile_lazy.
+    */
+    void set_lazy_functions(bool lazy) { lazy_functions = lazy; }
+
+    /**
+     * @brief Compile the body of a function left for its first call, in
+     * place.
+     * @return Whether it compiled, the errors are reported otherwise.
+    */
+    static bool compile_lazy(const Func& function, LibraryConstants library_constants);
+
 private:
     /**
      * @brief Number of parse rules.
     */
-    static constexpr size_t NUM_PARSE_RULES = 48;
+    static constexpr size_t NUM_PARSE_RULES = 69;
+
+    /**
+     * @brief Fewest cases a switch dispatches through a table, fewer are
+     * compared one by one.
+    */
+    static constexpr size_t SWITCH_TABLE_MIN_CASES = 4;
+
+    /**
+     * @brief Largest function body, in bytes, inlined at its call sites.
+    */
+    static constexpr int INLINE_MAX_SIZE = 64;
 
     /**
      * @brief Previous token.
@@ -273,6 +425,64 @@ private:
     */
     std::unique_ptr<ClassCompiler> class_compiler;
 
+    /**
+     * @brief Structs declared so far, in order.
+    */
+    std::vector<Struct> struct_types;
+
+    /**
+     * @brief Top level constants.
+    */
+    std::unordered_map<std::string, Value> constants;
+
+    /**
+     * @brief Source of the library constants for imports.
+    */
+    LibraryConstants library_constants;
+
+    /**
+     * @brief Names of the top level constants that came from libraries.
+    */
+    std::unordered_set<std::string> library_names;
+
+    /**
+     * @brief Cache of written_names().
+    */
+    std::optional<std::unordered_set<std::string>> written;
+
+    /**
+     * @brief Prefix '++' or '--' waiting for the end of its target.
+    */
+    std::optional<TokenType> pending_update;
+
+    /**
+     * @brief Top level functions declared so far, whose calls may be inlined.
+    */
+    std::unordered_map<std::string, Func> inline_functions;
+
+    /**
+     * @brief Methods declared so far by name, whose invocations may be
+     * inlined. Null when several classes declare the name.
+    */
+    std::unordered_map<std::string, Func> inline_methods;
+
+    /**
+     * @brief Top level function bodies are compiled on their first call.
+    */
+    bool lazy_functions = false;
+
+    /**
+     * @brief Shared by the functions left for their first call, filled at
+     * the end of the script.
+    */
+    std::shared_ptr<LazyScope> lazy_scope;
+
+    /**
+     * @brief Copy of the top level constants for those functions, dropped
+     * when a constant is added.
+    */
+    std::shared_ptr<const std::unordered_map<std::string, Value>> lazy_constants;
+
     /**
      * @brief Parser encountered a parsing error.
     */
@@ -348,11 +558,61 @@ private:
     */
     void emit_constant(const Value& value);
 
+    /**
+     * @brief Emit the load of a value known at compile time, with the
+     * shortest instruction, and record it for constant folding.
+    */
+    void emit_value(const Value& value);
+
+    /**
+     * @brief Fold a binary operator whose operands are the last two loads
+     * of known values.
+     * @param right_start Offset of the code of the right operand.
+     * @return Whether the operation got folded into a single load.
+    */
+    bool fold_binary(TokenType operator_type, int right_start);
+
+    /**
+     * @brief Fold a unary operator whose operand is the last load of a
+     * known value.
+     * @param operand_start Offset of the code of the operand.
+     * @return Whether the operation got folded into a single load.
+    */
+    bool fold_unary(TokenType operator_type, int operand_start);
+
+    /**
+     * @brief Make the constants of a library known, when the statement
+     * ahead is a top level import("library"); of the script. Names the
+     * source declares or assigns stay globals.
+    */
+    void import_constants();
+
+    /**
+     * @brief Names declared or assigned anywhere in the source, found by
+     * scanning it once.
+    */
+    const std::unordered_set<std::string>& written_names();
+
     /**
      * @brief Patch a jump instruction.
     */
     void patch_jump(int offset);
 
+    /**
+     * @brief Emit a comparison instruction, remembered for the fused branches.
+    */
+    void emit_comparison(Opcode op);
+
+    /**
+     * @brief Emit the jump taken when a condition is false: the fused
+     * compare and branch if the condition ends with a comparison,
+     * JumpIfFalse and Pop otherwise.
+     * @param pops_condition Set when the condition stays on the stack
+     * where the jump lands, to be popped there.
+     * @return Offset of the jump to patch.
+    */
+    int emit_condition_jump(bool& pops_condition);
+
     /**
      * @brief End compiler session.
     */
@@ -365,18 +625,29 @@ private:
     void call(bool can_assign);
     void dot(bool can_assign);
     void literal(bool can_assign);
+    void map(bool can_assign);
     void grouping(bool can_assign);
     void number(bool can_assign);
     void or_(bool can_assign);
     void string_(bool can_assign);
+    void template_string(bool can_assign);
     void named_variable(const std::string& name, bool can_assign);
     void variable(bool can_assign);
     void super(bool can_assign);
     void this_(bool can_assign);
     void and_(bool can_assign);
     void unary(bool can_assign);
+    void prefix_update(bool can_assign);
     /* Parsing functions for different keywords. */
 
+    /**
+     * @brief Match the update of the target just parsed: a pending prefix
+     * '++' or '--', a compound assignment or a postfix '++' or '--'. The
+     * operand of the update is compiled.
+     * @return Operator operand of the Compound opcodes, if any.
+    */
+    std::optional<uint8_t> match_update(bool can_assign);
+
     /**
      * @brief Get the parse rule related with this token.
     */
@@ -407,6 +678,14 @@ private:
     */
     uint8_t args_list();
 
+    /**
+     * @brief Parse an array element that is a lone literal (a number,
+     * possibly negated, a string, a boolean or null).
+     * @return Value of the literal, nothing if the element is any other
+     * expression (no token is consumed then).
+    */
+    std::optional<Value> literal_element();
+
     /**
      * @brief Parse an expression.
     */
@@ -419,8 +698,30 @@ private:
 
     /**
      * @brief Parse a function.
+     * @return The compiled function.
+    */
+    Func function(FunctionType type);
+
+    /**
+     * @brief Parse the parameters of a top level function and skip its
+     * body, which is compiled on the first call.
+     * @return The function, not compiled yet.
     */
-    void function(FunctionType type);
+    Func lazy_function();
+
+    /**
+     * @brief Inline the body of a function at a call whose callee and
+     * arguments are on the stack. The body runs behind a guard checking
+     * that the callee is still that function, a regular call otherwise.
+     * Only small bodies without calls, loops, closures or upvalues are
+     * inlined.
+     * @param callee Function expected to be called.
+     * @param arg_count Number of arguments of the call.
+     * @param method_name Constant of the method name for an invocation,
+     * -1 for a call.
+     * @return Whether the call was emitted, nothing is emitted otherwise.
+    */
+    bool emit_inline(const Func& callee, uint8_t arg_count, int method_name);
 
     /**
      * @brief Parse a method block statement.
@@ -432,6 +733,24 @@ private:
     */
     void class_declaration();
 
+    /**
+     * @brief Parse a struct declaration.
+    */
+    void struct_declaration();
+
+    /**
+     * @brief Find the slot of a field in the structs declared so far, the
+     * latest declaration first.
+     * @return Constant of the struct and index of the field, if any struct
+     * has such a field.
+    */
+    std::optional<std::pair<uint8_t, uint8_t>> struct_field(std::string_view field);
+
+    /**
+     * @brief Parse a constant declaration.
+    */
+    void const_declaration();
+
     /**
      * @brief Parse a function declaration.
     */
@@ -452,11 +771,26 @@ private:
     */
     void for_statement();
 
+    /**
+     * @brief Parse the rest of a for statement over a range,
+     * for (name in start..limit step step), or over the elements of an
+     * array, typed array, map or string, for (name in value).
+    */
+    void for_in_statement();
+
     /**
      * @brief Parse if statement.
     */
     void if_statement();
 
+    /**
+     * @brief Parse a switch statement. The case bodies are compiled first
+     * and the dispatch on the case values after them: a jump table for
+     * dense integers, a hashed table for other numbers, strings and
+     * booleans, or a chain of comparisons for a few cases.
+    */
+    void switch_statement();
+
     /**
      * @brief Parse a declaration.
     */
@@ -4,18 +4,22 @@
 // Elysabettian language headers.
 #include "runtime/value.h"
 #include "runtime/compiler.h"
+#include "runtime/map.h"
+#include "runtime/array_ops.h"
+#include "runtime/typed_array.h"
 
 #include "provider/earray.h"
+#include "provider/emap.h"
 #include "provider/emath.h"
 #include "provider/estdio.h"
 #include "provider/cstdio.h"
+#include "provider/estring.h"
 
 // Standard C++ headers.
 #include <map>
 #include <ctime>
+#include <optional>
 #include <cmath>
-#include <sstream>
-#include <iomanip>
 #include <functional>
 #include <unordered_map>
 
@@ -55,6 +59,45 @@ struct CallFrame {
     size_t stack_offset = 0;
 };
 
+/**
+ * @brief Converts a value to the string given by string() and by
+ * template strings.
+*/
+struct StringVisitor {
+    std::string operator()(const double d) const
+    {
+        char buffer[NUMBER_BUFFER_SIZE];
+        return std::string(buffer, format_number(buffer, d));
+    }
+    std::string operator()(const bool b) const { return b ? "true" : "false"; }
+    std::string operator()(const std::string& s) const { return s; }
+    std::string operator()(const std::monostate&) const { return "null"; }
+    std::string operator()(const Func& f) const
+    {
+        if (f->get_name().empty())
+            return "<script>";
+        return "<func " + f->get_name() + ">";
+    }
+    std::string operator()(const NativeFunc& nf) const { return "<native func>"; }
+    std::string operator()(const Closure& c) const { return "<closure>"; }
+    std::string operator()(const Upvalue& uv) const { return "<upvalue>"; }
+    std::string operator()(const Class& cv) const { return cv->name; }
+    std::string operator()(const Instance& iv) const { return iv->class_value->name + " instance"; }
+    std::string operator()(const MemberFunc& bm) const { return bm->method->function->get_name(); }
+    std::string operator()(const File& f) const { return f->path; }
+    std::string operator()(const Array& a) const { return "<array[" + std::to_string(a->size()) + "]>"; }
+    std::string operator()(const FILE* f) const { return "<native stream>"; }
+    std::string operator()(const Rope& r) const { return r->str(); }
+    std::string operator()(const Substring& s) const { return std::string(s->view()); }
+    std::string operator()(const Map& m) const { return "<map[" + std::to_string(m->size()) + "]>"; }
+    std::string operator()(const TypedArray& a) const
+    {
+        return "<" + std::string(TypedArrayObj::kind_name(a->kind())) + "array[" + std::to_string(a->size()) + "]>";
+    }
+    std::string operator()(const Struct& s) const { return s->name; }
+    std::string operator()(const StructInstance& s) const { return s->type->name + " instance"; }
+};
+
 /**
  * @brief Function call visitor
 */
@@ -81,12 +124,14 @@ public:
 
             std::string libname;
             try {
-                libname = std::get<std::string>(*args);
+                libname = std::string(as_string(*args));
                 const std::shared_ptr<stdlib::ELibrary>& lib = libraries.at(libname);
 
                 // Loading functions
                 for (const std::pair<std::string, NativeFn> f : lib->functions)
                     define_native(f.first, f.second);
+                for (const std::pair<std::string, VMNativeFn> f : lib->vm_functions)
+                    define_native(f.first, f.second);
                 // Loading constants
                 for (const std::pair<std::string, Value> c : lib->constants)
                     define_native_const(c.first, c.second);
@@ -110,33 +155,8 @@ public:
                 return std::monostate();
             }
 
-            struct TypeVisitor {
-                std::string operator()(const double d) const
-                {
-                    std::ostringstream ss;
-                    ss << std::setprecision(32) << std::noshowpoint << d;
-                    return ss.str();
-                }
-                std::string operator()(const std::string& s) const { return s; }
-                std::string operator()(const std::monostate&) const { return "null"; }
-                std::string operator()(const Func& f) const
-                {
-                    if (f->get_name().empty())
-                        return "<script>";
-                    return "<func " + f->get_name() + ">";
-                }
-                std::string operator()(const NativeFunc& nf) const { return "<native func>"; }
-                std::string operator()(const Closure& c) const { return "<closure>"; }
-                std::string operator()(const Upvalue& uv) const { return "<upvalue>"; }
-                std::string operator()(const Class& cv) const { return cv->name; }
-                std::string operator()(const Instance& iv) const { return iv->class_value->name + " instance"; }
-                std::string operator()(const MemberFunc& bm) const { return bm->method->function->get_name(); }
-                std::string operator()(const File& f) const { return f->path; }
-                std::string operator()(const Array& a) const { return "<array[" + std::to_string(a->values.size()) + "]"; }
-                std::string operator()(const FILE* f) const { return "<native stream>"; }
-            };
-
-            return std::visit(TypeVisitor(), *args);
+
+            return std::visit(StringVisitor(), *args);
         };
 
         IntFunc native_clock = [](int argc, std::vector<Value>::iterator args) -> Value {
@@ -169,6 +189,12 @@ public:
         // Load arrays
         for (const std::pair<std::string, NativeFn> func : array_lib.functions)
             define_native(func.first, func.second);
+        for (const std::pair<std::string, VMNativeFn> func : array_lib.vm_functions)
+            define_native(func.first, func.second);
+
+        // Load maps and sets
+        for (const std::pair<std::string, NativeFn> func : map_lib.functions)
+            define_native(func.first, func.second);
 
         stack.reserve(STACK_MAX);
         open_upvalues = nullptr;
@@ -188,11 +214,30 @@ public:
     */
     InterpretResult interpret(const std::string& source);
 
+    /**
+     * @brief Compile the bodies of top level functions on their first call
+     * rather than with the rest of the source.
+    */
+    void set_lazy_compilation(bool lazy) { lazy_compilation = lazy; }
+
     /**
      * @brief Runs the interpreted source code.
+     * @param base_frame Frame depth at which execution stops (0 runs the whole script).
      * @return Result of the interpretation.
     */
-    InterpretResult run();
+    InterpretResult run(size_t base_frame = 0);
+
+    /**
+     * @brief Call a callable value from native code and run it to completion.
+     * Natives may use this to call back into script closures; the call is
+     * re-entrant and may itself call further natives.
+     * @param callee Closure, native function, class or bound method to call.
+     * @param args Arguments passed to the callee.
+     * @return Result of the call, or std::nullopt if a runtime error was raised.
+     * In that case the error has already been reported and the VM unwound, so
+     * the native must return without touching its arguments again.
+    */
+    std::optional<Value> call_function(const Value& callee, const std::vector<Value>& args);
 
 private:
     /**
@@ -226,15 +271,38 @@ private:
     */
     const stdlib::EArray array_lib;
 
+    /**
+     * @brief Maps and sets library.
+    */
+    const stdlib::EMap map_lib;
+
     /**
      * @brief Libraries that can be loaded by the runtime on startup
     */
     const std::unordered_map<std::string, std::shared_ptr<stdlib::ELibrary>> libraries = {
         { "math", std::make_shared<stdlib::ELibrary>(stdlib::EMath()) },
         { "stdio", std::make_shared<stdlib::ELibrary>(stdlib::EStdio()) },
-        { "cstdio", std::make_shared<stdlib::ELibrary>(stdlib::CStdio()) }
+        { "cstdio", std::make_shared<stdlib::ELibrary>(stdlib::CStdio()) },
+        { "string", std::make_shared<stdlib::ELibrary>(stdlib::EString()) }
     };
 
+    /**
+     * @brief Top level constants known to the compiler, kept from one
+     * compilation to the next.
+    */
+    std::unordered_map<std::string, Value> compile_constants;
+
+    /**
+     * @brief Function bodies are compiled on their first call.
+    */
+    bool lazy_compilation = false;
+
+    /**
+     * @brief Constants of a library for the compiler, nullptr if there is
+     * no such library.
+    */
+    const std::unordered_map<std::string, Value>* library_constants(const std::string& name) const;
+
     /**
      * @brief Reset the VM stack.
     */
@@ -256,6 +324,11 @@ private:
     */
     void define_native(const std::string& name, NativeFn function);
 
+    /**
+     * @brief Define a native function bound to this virtual machine.
+    */
+    void define_native(const std::string& name, VMNativeFn function);
+
     /**
      * @brief Define a native constant.
     */
@@ -267,6 +340,39 @@ private:
     template <typename F>
     bool binary_op(F op);
 
+    /**
+     * @brief Apply an element-wise operation to the two operands on top of
+     * the stack, at least one of them being an array.
+    */
+    bool elementwise_op(ArrayOp op);
+
+    /**
+     * @brief Concatenate the two strings (or string and number) on top of
+     * the stack. Long results are built as ropes.
+    */
+    bool concatenate();
+
+    /**
+     * @brief Replace the parts of a template string on top of the stack by
+     * the string joining them, measured first and allocated once.
+    */
+    void interpolate(int count);
+
+    /**
+     * @brief Apply an arithmetic or bitwise operation to the two operands on
+     * top of the stack, as its opcode does.
+    */
+    bool arithmetic(Opcode op);
+
+    /**
+     * @brief Update a variable in place with the operand on top of the
+     * stack, which is replaced by the result of the expression.
+     * @param target Variable to update.
+     * @param mode Opcode of the operation, with COMPOUND_POSTFIX if the
+     * expression gives the old value.
+    */
+    bool compound_assign(Value& target, uint8_t mode);
+
     /**
      * @brief Perform a double pop and a push operation.
     */
@@ -314,6 +420,30 @@ private:
     */
     bool invoke_from_class(Class class_value, const std::string& name, int arg_count);
 
+    /**
+     * @brief Replace the instance or struct instance on top of the stack
+     * with one of its properties.
+    */
+    bool get_property(const std::string& name);
+
+    /**
+     * @brief Assign the value on top of the stack to a property of the
+     * instance or struct instance below it, leaving the value.
+    */
+    bool set_property(const std::string& name);
+
+    /**
+     * @brief Replace the array, typed array or map and the index on top of
+     * the stack with the element at that index.
+    */
+    bool index_get();
+
+    /**
+     * @brief Store the value on top of the stack at an index of the array,
+     * typed array or map below it, leaving the value.
+    */
+    bool index_set();
+
     /**
      * @brief Bind method to class.
     */
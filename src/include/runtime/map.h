@@ -0,0 +1,123 @@
+#ifndef ELY_RT_MAP_H
+#define ELY_RT_MAP_H
+
+// Elysabettian headers.
+#include "runtime/value.h"
+
+// Standard C++ headers.
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+/**
+ * @brief Map object, holds a hash table keyed by numbers, strings and
+ * booleans. A set is a map whose values are all true.
+ *
+ * The table is an open addressing "Swiss table": one control byte per
+ * slot holds 7 bits of the key hash (or marks the slot empty/deleted), and
+ * a lookup compares a whole group of 16 control bytes against the hash at
+ * once, touching the entries only for likely matches. Entries are stored
+ * densely in insertion order, which is also the iteration order.
+*/
+struct MapObj {
+    /**
+     * @brief Number of control bytes probed at once.
+    */
+    static constexpr size_t GROUP_WIDTH = 16;
+
+    struct Entry {
+        Value key;      // std::monostate once removed
+        Value value;
+        size_t hash;
+    };
+
+    explicit MapObj(bool is_set = false) : is_set(is_set) {}
+
+    /**
+     * @brief Keys must be numbers (not NaN), strings or booleans.
+    */
+    static bool is_hashable(const Value& key);
+
+    /**
+     * @brief Find the value stored for a key.
+     * @return Pointer to the value, nullptr if the key is absent.
+    */
+    Value* find(const Value& key);
+    const Value* find(const Value& key) const;
+
+    /**
+     * @brief Insert a key or overwrite its value. The key must be hashable.
+    */
+    void insert(const Value& key, Value value);
+
+    /**
+     * @brief Remove a key.
+     * @return Whether the key was present.
+    */
+    bool remove(const Value& key);
+
+    size_t size() const { return count; }
+
+    /**
+     * @brief Call func(key, value) for every entry, in insertion order.
+    */
+    template <typename Fn>
+    void for_each(Fn&& func) const
+    {
+        for (const Entry& entry : entries) {
+            if (!std::holds_alternative<std::monostate>(entry.key))
+                func(entry.key, entry.value);
+        }
+    }
+
+    /**
+     * @brief Iterate by position: the first entry at or after position,
+     * moving position past it. Safe while the map changes, removed entries
+     * are skipped and the ones added meanwhile are reached; an insertion
+     * that rebuilds the table compacts the entries, though.
+     * @return nullptr past the last entry.
+    */
+    const Entry* next(size_t& position) const
+    {
+        while (position < entries.size()) {
+            const Entry& entry = entries[position++];
+            if (!std::holds_alternative<std::monostate>(entry.key))
+                return &entry;
+        }
+        return nullptr;
+    }
+
+    const bool is_set;
+
+private:
+    static constexpr int8_t EMPTY = -128;
+    static constexpr int8_t DELETED = -2;
+    static constexpr size_t NOT_FOUND = SIZE_MAX;
+
+    /**
+     * @brief Slot of a key in the table, NOT_FOUND if absent.
+    */
+    size_t find_slot(const Value& key, size_t hash) const;
+
+    /**
+     * @brief First empty or deleted slot on the probe sequence of a hash.
+    */
+    size_t find_free_slot(size_t hash) const;
+
+    void set_control(size_t slot, int8_t control);
+    void rehash(size_t new_capacity);
+
+    // capacity + GROUP_WIDTH bytes, the first group is mirrored at the end
+    // so that a group can be loaded at any slot.
+    std::vector<int8_t> control;
+    // Table slot -> position in entries.
+    std::vector<uint32_t> slots;
+    std::vector<Entry> entries;
+    size_t capacity = 0;
+    size_t count = 0;
+    size_t growth_left = 0;
+    // Removed entries still in entries.
+    size_t removed = 0;
+};
+
+#endif
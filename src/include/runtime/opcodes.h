@@ -53,7 +53,56 @@ enum class Opcode : uint8_t {
     ArrIndex,
     ArrStore,
     ShiftLeft,
-    ShiftRight
+    ShiftRight,
+    MapBuild,
+    ArrClone,
+    ArrExtend,
+    ArrAppend,
+    GetField,
+    SetField,
+    ForPrep,
+    ForLoop,
+    IterNext,
+    NotEqual,
+    GreaterEqual,
+    LessEqual,
+    JumpIfNotEqual,
+    JumpIfEqual,
+    JumpIfNotGreater,
+    JumpIfNotGreaterEqual,
+    JumpIfNotLess,
+    JumpIfNotLessEqual,
+    CompoundLocal,
+    CompoundUpvalue,
+    CompoundGlobal,
+    CompoundProperty,
+    CompoundIndex,
+    JumpTable,
+    SwitchMap,
+    Interpolate,
+    ReturnValues,
+    Unpack,
+    InlineCall,
+    InlineInvoke,
+    GetSlot,
+    SetSlot,
+    InlineEnd
+};
+
+/**
+ * @brief Or-ed into the operator operand of the Compound opcodes (the
+ * opcode of the binary operation): the expression gives the old value
+ * instead of the new one, for postfix increments and decrements.
+*/
+constexpr uint8_t COMPOUND_POSTFIX = 0x80;
+
+/**
+ * @brief Describes how Opcode::Closure captures each upvalue.
+*/
+enum class CaptureKind : uint8_t {
+    Upvalue,    // Slot of the enclosing closure, shared as it is.
+    Boxed,      // Enclosing local reassigned after capture, shared by reference.
+    Value       // Enclosing local never reassigned, copied into the closure.
 };
 
 
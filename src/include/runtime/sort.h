@@ -0,0 +1,297 @@
+#ifndef ELY_RT_SORT_H
+#define ELY_RT_SORT_H
+
+// Standard C++ headers.
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+#include <cstddef>
+#include <type_traits>
+
+/**
+ * @brief Sorting algorithms used by the array library.
+*/
+namespace sort {
+
+namespace detail {
+    constexpr ptrdiff_t INSERTION_SORT_THRESHOLD = 24;
+    constexpr ptrdiff_t NINTHER_THRESHOLD = 128;
+    constexpr ptrdiff_t PARTIAL_INSERTION_SORT_LIMIT = 8;
+
+    /*
+     * Every scan below is bounded explicitly instead of relying on the pivot
+     * as a sentinel: comparators written in scripts may be inconsistent,
+     * which must give an unspecified order but never run out of the range.
+     */
+
+    template <typename Iter, typename Compare>
+    void insertion_sort(Iter begin, Iter end, Compare& comp)
+    {
+        if (begin == end)
+            return;
+
+        for (Iter cur = begin + 1; cur != end; ++cur) {
+            Iter sift = cur;
+            Iter sift_1 = cur - 1;
+            if (comp(*sift, *sift_1)) {
+                auto tmp = std::move(*sift);
+                do {
+                    *sift-- = std::move(*sift_1);
+                } while (sift != begin && comp(tmp, *--sift_1));
+                *sift = std::move(tmp);
+            }
+        }
+    }
+
+    /**
+     * @brief Insertion sort that gives up after moving a few elements.
+     * @return Whether the range got sorted.
+    */
+    template <typename Iter, typename Compare>
+    bool partial_insertion_sort(Iter begin, Iter end, Compare& comp)
+    {
+        if (begin == end)
+            return true;
+
+        ptrdiff_t moved = 0;
+        for (Iter cur = begin + 1; cur != end; ++cur) {
+            Iter sift = cur;
+            Iter sift_1 = cur - 1;
+            if (comp(*sift, *sift_1)) {
+                auto tmp = std::move(*sift);
+                do {
+                    *sift-- = std::move(*sift_1);
+                } while (sift != begin && comp(tmp, *--sift_1));
+                *sift = std::move(tmp);
+                moved += cur - sift;
+            }
+            if (moved > PARTIAL_INSERTION_SORT_LIMIT)
+                return false;
+        }
+        return true;
+    }
+
+    template <typename Iter, typename Compare>
+    void sort2(Iter a, Iter b, Compare& comp)
+    {
+        if (comp(*b, *a))
+            std::iter_swap(a, b);
+    }
+
+    template <typename Iter, typename Compare>
+    void sort3(Iter a, Iter b, Iter c, Compare& comp)
+    {
+        sort2(a, b, comp);
+        sort2(b, c, comp);
+        sort2(a, b, comp);
+    }
+
+    /**
+     * @brief Partition around the pivot in *begin, elements equal to it go right.
+     * @return Position of the pivot and whether the range was already partitioned.
+    */
+    template <typename Iter, typename Compare>
+    std::pair<Iter, bool> partition_right(Iter begin, Iter end, Compare& comp)
+    {
+        auto pivot = std::move(*begin);
+
+        Iter first = begin + 1;
+        Iter last = end;
+        while (first < last && comp(*first, pivot))
+            ++first;
+        while (last > first && !comp(*(last - 1), pivot))
+            --last;
+
+        const bool already_partitioned = first >= last;
+        while (first < last) {
+            std::iter_swap(first, last - 1);
+            ++first;
+            --last;
+            while (first < last && comp(*first, pivot))
+                ++first;
+            while (last > first && !comp(*(last - 1), pivot))
+                --last;
+        }
+
+        Iter pivot_pos = std::min(first, last) - 1;
+        *begin = std::move(*pivot_pos);
+        *pivot_pos = std::move(pivot);
+        return { pivot_pos, already_partitioned };
+    }
+
+    /**
+     * @brief Partition around the pivot in *begin, elements equal to it go
+     * left. Used when the pivot equals the element before the range, so the
+     * equal elements are done and skipped at once.
+    */
+    template <typename Iter, typename Compare>
+    Iter partition_left(Iter begin, Iter end, Compare& comp)
+    {
+        auto pivot = std::move(*begin);
+
+        Iter first = begin + 1;
+        Iter last = end;
+        while (last > first && comp(pivot, *(last - 1)))
+            --last;
+        while (first < last && !comp(pivot, *first))
+            ++first;
+
+        while (first < last) {
+            std::iter_swap(first, last - 1);
+            ++first;
+            --last;
+            while (last > first && comp(pivot, *(last - 1)))
+                --last;
+            while (first < last && !comp(pivot, *first))
+                ++first;
+        }
+
+        Iter pivot_pos = std::min(first, last) - 1;
+        *begin = std::move(*pivot_pos);
+        *pivot_pos = std::move(pivot);
+        return pivot_pos;
+    }
+
+    template <typename Iter, typename Compare>
+    void pdqsort_loop(Iter begin, Iter end, Compare& comp, int bad_allowed, bool leftmost)
+    {
+        while (true) {
+            const ptrdiff_t size = end - begin;
+            if (size < INSERTION_SORT_THRESHOLD) {
+                insertion_sort(begin, end, comp);
+                return;
+            }
+
+            // Move the median of 3 (or pseudo median of 9) to *begin.
+            const ptrdiff_t half = size / 2;
+            if (size > NINTHER_THRESHOLD) {
+                sort3(begin, begin + half, end - 1, comp);
+                sort3(begin + 1, begin + (half - 1), end - 2, comp);
+                sort3(begin + 2, begin + (half + 1), end - 3, comp);
+                sort3(begin + (half - 1), begin + half, begin + (half + 1), comp);
+                std::iter_swap(begin, begin + half);
+            } else {
+                sort3(begin + half, begin, end - 1, comp);
+            }
+
+            if (!leftmost && !comp(*(begin - 1), *begin)) {
+                begin = partition_left(begin, end, comp) + 1;
+                continue;
+            }
+
+            auto [pivot_pos, already_partitioned] = partition_right(begin, end, comp);
+            const ptrdiff_t left_size = pivot_pos - begin;
+            const ptrdiff_t right_size = end - (pivot_pos + 1);
+
+            if (left_size < size / 8 || right_size < size / 8) {
+                // Too many bad pivots, the input defeats the pivot choice.
+                if (--bad_allowed == 0) {
+                    std::make_heap(begin, end, comp);
+                    std::sort_heap(begin, end, comp);
+                    return;
+                }
+
+                // Break up patterns that produce bad pivots.
+                if (left_size >= INSERTION_SORT_THRESHOLD) {
+                    std::iter_swap(begin, begin + left_size / 4);
+                    std::iter_swap(pivot_pos - 1, pivot_pos - left_size / 4);
+                }
+                if (right_size >= INSERTION_SORT_THRESHOLD) {
+                    std::iter_swap(pivot_pos + 1, pivot_pos + (1 + right_size / 4));
+                    std::iter_swap(end - 1, end - right_size / 4);
+                }
+            } else if (already_partitioned && partial_insertion_sort(begin, pivot_pos, comp)
+                       && partial_insertion_sort(pivot_pos + 1, end, comp)) {
+                // Nearly sorted input finishes in linear time.
+                return;
+            }
+
+            pdqsort_loop(begin, pivot_pos, comp, bad_allowed, leftmost);
+            begin = pivot_pos + 1;
+            leftmost = false;
+        }
+    }
+
+    template <typename T>
+    inline auto radix_key(T value)
+    {
+        if constexpr (std::is_same_v<T, double>) {
+            // Flip negative numbers entirely and the sign of positive ones,
+            // so that the bits order like the values.
+            uint64_t bits;
+            std::memcpy(&bits, &value, sizeof(bits));
+            return (bits >> 63) != 0 ? ~bits : bits | (uint64_t(1) << 63);
+        } else if constexpr (std::is_signed_v<T>) {
+            using Key = std::make_unsigned_t<T>;
+            return static_cast<Key>(static_cast<Key>(value) ^ (Key(1) << (sizeof(T) * 8 - 1)));
+        } else {
+            return value;
+        }
+    }
+}
+
+/**
+ * @brief Pattern-defeating quicksort: introsort with a median of 3/9
+ * pivot, partition_left for runs of equal elements, partial insertion
+ * sort for nearly sorted input and a heapsort fallback. Not stable.
+*/
+template <typename Iter, typename Compare>
+void pdqsort(Iter begin, Iter end, Compare comp)
+{
+    if (begin == end)
+        return;
+
+    int bad_allowed = 1;
+    for (ptrdiff_t size = end - begin; size > 1; size >>= 1)
+        ++bad_allowed;
+    detail::pdqsort_loop(begin, end, comp, bad_allowed, true);
+}
+
+/**
+ * @brief Sort numbers in ascending order: LSD radix sort on the bytes of an
+ * order preserving key, skipping the bytes that are the same for every
+ * element. Short inputs use pdqsort.
+*/
+template <typename T>
+void radix_sort(std::vector<T>& values)
+{
+    constexpr size_t PASSES = sizeof(T);
+    const size_t size = values.size();
+    if (size < 256) {
+        pdqsort(values.begin(), values.end(), [](const T& a, const T& b) {
+            return detail::radix_key(a) < detail::radix_key(b);
+        });
+        return;
+    }
+
+    std::vector<size_t> counts(PASSES * 256, 0);
+    for (const T& value : values) {
+        const auto key = detail::radix_key(value);
+        for (size_t pass = 0; pass < PASSES; ++pass)
+            ++counts[pass * 256 + ((key >> (pass * 8)) & 0xFF)];
+    }
+
+    std::vector<T> buffer(size);
+    for (size_t pass = 0; pass < PASSES; ++pass) {
+        size_t* count = &counts[pass * 256];
+        if (count[(detail::radix_key(values[0]) >> (pass * 8)) & 0xFF] == size)
+            continue;
+
+        size_t offset = 0;
+        for (size_t bucket = 0; bucket < 256; ++bucket) {
+            const size_t bucket_size = count[bucket];
+            count[bucket] = offset;
+            offset += bucket_size;
+        }
+        for (const T& value : values)
+            buffer[count[(detail::radix_key(value) >> (pass * 8)) & 0xFF]++] = value;
+        values.swap(buffer);
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,84 @@
+#ifndef ELY_RT_TYPED_ARRAY_H
+#define ELY_RT_TYPED_ARRAY_H
+
+// Elysabettian headers.
+#include "runtime/value.h"
+
+// Standard C++ headers.
+#include <vector>
+#include <variant>
+#include <optional>
+#include <cstdint>
+#include <cmath>
+#include <type_traits>
+
+/**
+ * @brief Element type of a typed array, in the order of the
+ * alternatives of TypedArrayObj::Storage.
+*/
+enum class ElementKind : uint8_t {
+    F64, I64, I32, U8
+};
+
+/**
+ * @brief Typed array object, holds numbers unboxed in contiguous storage.
+ * Elements are read as numbers; stores convert to the element type,
+ * truncating towards zero and wrapping for the integer kinds (non finite
+ * values store 0).
+*/
+struct TypedArrayObj {
+    using Storage = std::variant<std::vector<double>, std::vector<int64_t>,
+                                 std::vector<int32_t>, std::vector<uint8_t>>;
+
+    Storage elements;
+
+    TypedArrayObj(ElementKind kind, size_t size, double fill = 0);
+
+    /**
+     * @brief Parse an element kind name ("f64", "i64", "i32" or "u8").
+    */
+    static std::optional<ElementKind> parse_kind(std::string_view name);
+    static const char* kind_name(ElementKind kind);
+
+    template <typename T>
+    static inline T convert(double value)
+    {
+        if constexpr (std::is_same_v<T, double>) {
+            return value;
+        } else {
+            if (!(std::fabs(value) < 9.2e18))
+                return 0;
+            return static_cast<T>(static_cast<int64_t>(value));
+        }
+    }
+
+    inline ElementKind kind() const { return static_cast<ElementKind>(elements.index()); }
+
+    inline size_t size() const
+    {
+        return std::visit([](const auto& values) { return values.size(); }, elements);
+    }
+
+    inline double get(size_t index) const
+    {
+        return std::visit([index](const auto& values) { return static_cast<double>(values[index]); }, elements);
+    }
+
+    inline void set(size_t index, double value)
+    {
+        std::visit([index, value](auto& values) {
+            using T = typename std::decay_t<decltype(values)>::value_type;
+            values[index] = convert<T>(value);
+        }, elements);
+    }
+
+    inline void push(double value)
+    {
+        std::visit([value](auto& values) {
+            using T = typename std::decay_t<decltype(values)>::value_type;
+            values.push_back(convert<T>(value));
+        }, elements);
+    }
+};
+
+#endif
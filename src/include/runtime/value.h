@@ -11,8 +11,13 @@
 #include <unordered_map>
 #include <map>
 #include <functional>
+#include <optional>
+#include <algorithm>
 #include <cstdio>
 
+// fmt headers.
+#include <fmt/compile.h>
+
 /**
  * @brief Native function object, holds a representation of a
  * native function.
@@ -55,6 +60,42 @@ struct FileObj;
 */
 struct ArrayObj;
 
+/**
+ * @brief Rope object, holds a string built by concatenation that
+ * is flattened only when its content is observed.
+*/
+struct RopeObj;
+
+/**
+ * @brief Substring object, holds a view over part of a shared
+ * string without copying it.
+*/
+struct SubstringObj;
+
+/**
+ * @brief Typed array object, holds numbers of a single element
+ * type in contiguous storage.
+*/
+struct TypedArrayObj;
+
+/**
+ * @brief Map object, holds a hash table from keys to values
+ * (or a set of keys).
+*/
+struct MapObj;
+
+/**
+ * @brief Struct object, holds the fixed field layout of a struct
+ * declaration.
+*/
+struct StructObj;
+
+/**
+ * @brief Struct instance object, holds the fields of a struct value
+ * in slots.
+*/
+struct StructInstanceObj;
+
 /**
  * @brief Function object, holds the representation of a function
  * in the Elysabettian language.
@@ -81,6 +122,11 @@ class Compiler;
 */
 class Parser;
 
+/**
+ * @brief Source of a function compiled on its first call.
+*/
+struct LazyFunction;
+
 /**
  * @brief Executes the bytecode on the target architecture.
 */
@@ -131,13 +177,45 @@ using File = std::shared_ptr<FileObj>;
 */
 using Array = std::shared_ptr<ArrayObj>;
 
+/**
+ * @brief Elysabettian lazily concatenated string.
+*/
+using Rope = std::shared_ptr<RopeObj>;
+
+/**
+ * @brief Elysabettian view over part of a string.
+*/
+using Substring = std::shared_ptr<SubstringObj>;
+
+/**
+ * @brief Elysabettian typed (unboxed numeric) array object.
+*/
+using TypedArray = std::shared_ptr<TypedArrayObj>;
+
+/**
+ * @brief Elysabettian map or set object.
+*/
+using Map = std::shared_ptr<MapObj>;
+
+/**
+ * @brief Elysabettian struct declaration.
+*/
+using Struct = std::shared_ptr<StructObj>;
+
+/**
+ * @brief Elysabettian struct instance.
+*/
+using StructInstance = std::shared_ptr<StructInstanceObj>;
+
 /**
  * @brief Elysabettian language value.
 */
 using Value = std::variant<double, bool, std::monostate,
                            std::string, Func, NativeFunc,
                            Closure, Upvalue, Class, Instance,
-                           MemberFunc, File, Array, FILE*>;
+                           MemberFunc, File, Array, FILE*,
+                           Rope, Substring, Map, TypedArray,
+                           Struct, StructInstance>;
 
 /**
  * @brief Memory chunk with support for different operation.
@@ -148,17 +226,38 @@ class Chunk {
     std::vector<Value> constants;
     std::vector<int> lines;
 
+    /**
+     * @brief Array literal templates, indexed with two bytes apart from
+     * the constants so that they never crowd them out.
+    */
+    std::vector<Array> templates;
+
 public:
     uint8_t get_code(size_t offset) const { return code[offset]; };
     void set_code(int offset, uint8_t value) { code[offset] = value; }
     const Value& get_constant(int constant) const { return constants[constant]; };
+    const Array& get_template(int index) const { return templates[index]; }
+    /**
+     * @brief Index of a template with the same values, which is added if
+     * there is none. Templates are never written, equal ones are shared.
+    */
+    size_t add_template(Array pattern);
     void write(uint8_t byte, int line);
     void write(Opcode opcode, int line);
     size_t add_constant(Value value);
+    /**
+     * @brief Index of a number or string constant equal to value, or of
+     * the same struct or function, if any.
+    */
+    std::optional<size_t> find_constant(const Value& value) const;
     int disas_instruction(int offset);
     void disassemble(const std::string& name);
     int get_line(size_t instruction) { return lines[instruction]; }
     int count() { return static_cast<int>(code.size()); }
+    /**
+     * @brief Drop the code from offset on, constants are kept.
+    */
+    void truncate(int offset) { code.resize(offset); lines.resize(offset); }
 };
 
 /**
@@ -166,6 +265,12 @@ public:
 */
 using NativeFn = std::function<Value(int, std::vector<Value>::iterator)>;
 
+/**
+ * @brief Native Function type with access to the running virtual machine.
+ * Used by natives that need to call back into script code.
+*/
+using VMNativeFn = std::function<Value(VirtualMachine&, int, std::vector<Value>::iterator)>;
+
 /**
  * @brief Native function object, holds a representation of a
  * native function.
@@ -205,6 +310,41 @@ struct InstanceObj {
     explicit InstanceObj(Class klass): class_value(klass) {}
 };
 
+/**
+ * @brief Struct object, holds the name and the field layout of a struct
+ * declaration. Built by the compiler, which knows the slot of every field.
+*/
+struct StructObj {
+    std::string name;
+    std::vector<std::string> fields;
+
+    StructObj(std::string name, std::vector<std::string> fields)
+        : name(std::move(name)), fields(std::move(fields)) {}
+
+    /**
+     * @brief Find the slot of a field.
+     * @return Index of the field, -1 if the struct has no such field.
+    */
+    inline int field_index(std::string_view field) const
+    {
+        for (size_t i = 0; i < fields.size(); ++i) {
+            if (fields[i] == field)
+                return static_cast<int>(i);
+        }
+        return -1;
+    }
+};
+
+/**
+ * @brief Struct instance object, holds one slot per field of its struct,
+ * in declaration order.
+*/
+struct StructInstanceObj {
+    Struct type;
+    std::vector<Value> fields;
+    explicit StructInstanceObj(Struct type): type(type), fields(type->fields.size(), std::monostate()) {}
+};
+
 /**
  * @brief Member function (method) object, holds the representation
  * of a member function in the Elysabettian language.
@@ -226,6 +366,10 @@ private:
     int upvalue_count = 0;
     std::string name;
     Chunk chunk;
+    /**
+     * @brief Set while the body is not compiled yet, the chunk is empty.
+    */
+    std::shared_ptr<LazyFunction> lazy;
 
 public:
     FunctionObj(int arity, const std::string& name)
@@ -256,6 +400,11 @@ public:
         return chunk.get_constant(constant);
     }
 
+    const Array& get_template(int index) const
+    {
+        return chunk.get_template(index);
+    }
+
     friend Compiler;
     friend Parser;
     friend VirtualMachine;
@@ -270,10 +419,14 @@ public:
 class ClosureObj {
 public:
     Func function;
-    std::vector<Upvalue> upvalues;
+    /**
+     * @brief Captured variables. Each slot holds either the captured value
+     * itself or, for variables reassigned after capture, a boxed Upvalue.
+    */
+    std::vector<Value> upvalues;
     explicit ClosureObj(Func function): function(function)
     {
-        upvalues.resize(function->upvalue_count, nullptr);
+        upvalues.resize(function->upvalue_count);
     };
 };
 
@@ -324,7 +477,7 @@ struct FileObj {
         return buffer;
     }
 
-    inline void write_all(const std::string& data)
+    inline void write_all(std::string_view data)
     {
         if (!this->is_open()) {
             return;
@@ -342,15 +495,300 @@ struct FileObj {
 /**
  * @brief Array object, holds the representation of an array in
  * the Elysabettian language.
+ *
+ * An array either owns its elements or is a view over a range of another
+ * array (its parent, never a view itself): views read and write the
+ * parent's elements, so slicing costs O(1). Resizing a view detaches it
+ * into an array of its own. Copies share the elements until one of the
+ * sharers writes to them.
 */
 struct ArrayObj {
-    std::vector<Value> values;
+    using Storage = std::vector<Value>;
+
+    ArrayObj() : storage(std::make_shared<Storage>()) {}
+    explicit ArrayObj(Storage values) : storage(std::make_shared<Storage>(std::move(values))) {}
+
+    /**
+     * @brief View over [begin, end) of an array, clamped to its size.
+    */
+    static Array slice(const Array& array, size_t begin, size_t end);
+
+    /**
+     * @brief Copy of an array, sharing the elements until the first write.
+    */
+    static Array copy(const Array& array);
+
+    inline bool is_view() const { return parent != nullptr; }
+
+    inline size_t size() const
+    {
+        if (parent == nullptr)
+            return storage->size();
+        // The parent may have shrunk since the view was taken.
+        const size_t parent_size = parent->size();
+        return offset < parent_size ? std::min(length, parent_size - offset) : 0;
+    }
+
+    /**
+     * @brief Number of elements held without reallocating. Views cannot
+     * grow in place and report their size.
+    */
+    inline size_t capacity() const
+    {
+        return parent == nullptr ? storage->capacity() : size();
+    }
+
+    inline const Value& get(size_t index) const
+    {
+        return parent == nullptr ? (*storage)[index] : (*parent->storage)[offset + index];
+    }
+
+    inline void set(size_t index, Value value)
+    {
+        mutable_data()[index] = std::move(value);
+    }
+
+    inline const Value* begin() const
+    {
+        return parent == nullptr ? storage->data() : parent->storage->data() + offset;
+    }
+
+    inline const Value* end() const { return begin() + size(); }
+
+    /**
+     * @brief Elements for writing in place, unshared first. Views write
+     * through to their parent.
+    */
+    inline Value* mutable_data()
+    {
+        if (parent != nullptr)
+            return parent->mutable_data() + offset;
+        if (storage.use_count() > 1)
+            storage = std::make_shared<Storage>(*storage);
+        return storage->data();
+    }
+
+    /**
+     * @brief Elements for resizing, unshared first. Views are detached.
+    */
+    Storage& resizable();
+
+    inline void push(Value value) { resizable().push_back(std::move(value)); }
+
+private:
+    ArrayObj(Array parent, size_t offset, size_t length)
+        : parent(std::move(parent)), offset(offset), length(length) {}
+
+    // Elements of an array, shared between copies; null in views.
+    std::shared_ptr<Storage> storage;
+
+    Array parent;
+    size_t offset = 0;
+    size_t length = 0;
+};
+
+/**
+ * @brief Rope object, holds a string built by concatenation that
+ * is flattened only when its content is observed.
+*/
+struct RopeObj {
+    /**
+     * @brief Concatenations shorter than this are performed eagerly.
+    */
+    static constexpr size_t MIN_LENGTH = 64;
+
+    /**
+     * @brief Ropes deeper than this are flattened on concatenation, which
+     * bounds the cost of a flattening and the recursion of destructors.
+    */
+    static constexpr size_t MAX_DEPTH = 512;
+
+    explicit RopeObj(std::string leaf)
+        : length(leaf.size()), depth(0), flat(std::move(leaf)) {}
+
+    RopeObj(Rope left, Rope right)
+        : length(left->length + right->length),
+          depth(std::max(left->depth, right->depth) + 1),
+          left(std::move(left)), right(std::move(right)) {}
+
+    inline size_t size() const { return length; }
+
+    inline bool is_flat() const { return left == nullptr; }
+
+    inline bool is_too_deep() const { return depth > MAX_DEPTH; }
+
+    /**
+     * @brief Get the content of the rope, flattening it on first use.
+    */
+    inline const std::string& str() const
+    {
+        if (is_flat()) {
+            return flat;
+        }
+
+        std::string buffer;
+        buffer.reserve(length);
+
+        // Iterative in-order walk, leaves are appended left to right.
+        std::vector<const RopeObj*> pending{ this };
+        while (!pending.empty()) {
+            const RopeObj* node = pending.back();
+            pending.pop_back();
+
+            if (node->is_flat()) {
+                buffer += node->flat;
+            } else {
+                pending.push_back(node->right.get());
+                pending.push_back(node->left.get());
+            }
+        }
+
+        flat = std::move(buffer);
+        left = nullptr;
+        right = nullptr;
+        depth = 0;
+        return flat;
+    }
+
+private:
+    size_t length;
+    mutable size_t depth;
+    mutable std::string flat;
+    mutable Rope left;
+    mutable Rope right;
+};
+
+/**
+ * @brief Encoding of a piece of text, as found by validating it.
+*/
+enum class TextEncoding : uint8_t {
+    Unknown, Ascii, Utf8, Invalid
+};
+
+/**
+ * @brief Substring object, holds a view over part of a shared
+ * string without copying it. Strings are immutable, so a view never
+ * needs to be materialized while it shares ownership of its source.
+*/
+struct SubstringObj {
+    /**
+     * @brief Pieces shorter than this are copied into small strings instead,
+     * which need no allocation and do not keep a large source alive.
+    */
+    static constexpr size_t MIN_LENGTH = 16;
+
+    /**
+     * @brief Number of code points between two entries of the code point index.
+    */
+    static constexpr size_t INDEX_STRIDE = 64;
+
+    std::shared_ptr<const std::string> source;
+    size_t offset;
+    size_t length;
+
+    /**
+     * @brief Encoding of the view, found on first use (or when loaded) and
+     * kept so that ASCII text is indexed by byte without rescanning it.
+    */
+    mutable TextEncoding encoding = TextEncoding::Unknown;
+
+    /**
+     * @brief Multibyte text only, built lazily: number of code points and
+     * byte offset of every INDEX_STRIDE-th code point.
+    */
+    mutable size_t code_points = 0;
+    mutable std::vector<size_t> code_point_index;
+
+    SubstringObj(std::shared_ptr<const std::string> source, size_t offset, size_t length)
+        : source(std::move(source)), offset(offset), length(length) {}
+
+    inline std::string_view view() const
+    {
+        return std::string_view(source->data() + offset, length);
+    }
 };
 
+/**
+ * @brief Make a string value for part of a shared string: short pieces
+ * are copied, longer ones reference the source.
+*/
+inline Value make_substring(const std::shared_ptr<const std::string>& source, size_t offset, size_t length)
+{
+    if (length < SubstringObj::MIN_LENGTH) {
+        return std::string(source->data() + offset, length);
+    }
+    return std::make_shared<SubstringObj>(source, offset, length);
+}
+
+/**
+ * @brief Check if a value is a string, a rope or a substring.
+*/
+inline bool is_string(const Value& v)
+{
+    return std::holds_alternative<std::string>(v) || std::holds_alternative<Rope>(v)
+        || std::holds_alternative<Substring>(v);
+}
+
+/**
+ * @brief Get the characters of a string, rope or substring value.
+ * The view is valid as long as the value is alive.
+ * @throws std::bad_variant_access if the value is not a string.
+*/
+inline std::string_view as_string(const Value& v)
+{
+    if (const std::string* str = std::get_if<std::string>(&v)) {
+        return *str;
+    } else if (const Rope* rope = std::get_if<Rope>(&v)) {
+        return (*rope)->str();
+    }
+    return std::get<Substring>(v)->view();
+}
+
+/**
+ * @brief Compare two values, strings are compared by content whatever
+ * their representation.
+*/
+inline bool values_equal(const Value& a, const Value& b)
+{
+    if (is_string(a) && is_string(b)) {
+        return as_string(a) == as_string(b);
+    }
+    return a == b;
+}
+
+/**
+ * @brief Size of a buffer large enough for any formatted number.
+*/
+constexpr size_t NUMBER_BUFFER_SIZE = 32;
+
+/**
+ * @brief Write the shortest representation of a number that reads back
+ * to the same value (Dragonbox), without trailing zeros.
+ * @param out Buffer of at least NUMBER_BUFFER_SIZE characters.
+ * @return Pointer past the last written character.
+*/
+inline char* format_number(char* out, double num)
+{
+    return fmt::format_to(out, FMT_COMPILE("{}"), num);
+}
+
+/**
+ * @brief Append the shortest round-trip representation of a number.
+*/
+inline void append_number(std::string& out, double num)
+{
+    char buffer[NUMBER_BUFFER_SIZE];
+    out.append(buffer, format_number(buffer, num));
+}
+
 std::ostream& operator<<(std::ostream& os, const Value& v);
 
 struct OutputVisitor {
-    void operator()(const double d) const { std::cout << d; }
+    void operator()(const double d) const
+    {
+        char buffer[NUMBER_BUFFER_SIZE];
+        std::cout.write(buffer, format_number(buffer, d) - buffer);
+    }
     void operator()(const bool b) const { std::cout << (b ? "true" : "false"); }
     void operator()(const std::monostate n) const { std::cout << "null"; }
     void operator()(const std::string& s) const { std::cout << s; }
@@ -386,15 +824,28 @@ struct OutputVisitor {
     }
     void operator()(const Array& a) const
     {
+        const size_t size = a->size();
         std::cout << "[ ";
-        for (size_t i = 0; i < a->values.size(); ++i) {
-            if (i < (a->values.size() - 1))
-                std::cout << a->values[i] << ", ";
+        for (size_t i = 0; i < size; ++i) {
+            if (i < size - 1)
+                std::cout << a->get(i) << ", ";
             else
-                std::cout << a->values[i];
+                std::cout << a->get(i);
         }
         std::cout << " ]";
     }
+    void operator()(const Rope& r) const { std::cout << r->str(); }
+    void operator()(const Substring& s) const { std::cout << s->view(); }
+    void operator()(const Map& m) const;
+    void operator()(const TypedArray& a) const;
+    void operator()(const Struct& s) const { std::cout << "<struct " << s->name << ">"; }
+    void operator()(const StructInstance& s) const
+    {
+        std::cout << s->type->name << " {";
+        for (size_t i = 0; i < s->fields.size(); ++i)
+            std::cout << (i == 0 ? " " : ", ") << s->type->fields[i] << ": " << s->fields[i];
+        std::cout << (s->fields.empty() ? "}" : " }");
+    }
 };
 
 inline std::ostream& operator<<(std::ostream& os, const Value& v)
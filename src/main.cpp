@@ -62,8 +62,11 @@ int main(int argc, const char * argv[])
         RunFile(vm, argv[1]);
     } else if (argc == 3 && strcmp(argv[1], "-c") == 0) {
         RunCommand(vm, argv[2]);
+    } else if (argc == 3 && strcmp(argv[1], "--lazy") == 0) {
+        vm.set_lazy_compilation(true);
+        RunFile(vm, argv[2]);
     } else {
-        std::cerr << "Usage: cely [PATH_TO_SCRIPT]" << std::endl;
+        std::cerr << "Usage: cely [--lazy] [PATH_TO_SCRIPT]" << std::endl;
         exit(64);
     }
 
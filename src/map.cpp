@@ -0,0 +1,228 @@
+#include "runtime/map.h"
+
+#include <cmath>
+#include <cstring>
+#include <string_view>
+
+#if defined(__SSE2__) || defined(_M_X64)
+    #include <emmintrin.h>
+#endif
+
+/**
+ * @brief A group of GROUP_WIDTH control bytes, matched all at once.
+ * Full slots hold the low 7 bits of the hash (0..127), empty and deleted
+ * slots are negative, which makes "free" a single signed compare.
+*/
+struct ControlGroup {
+#if defined(__SSE2__) || defined(_M_X64)
+    __m128i bytes;
+
+    explicit ControlGroup(const int8_t* control)
+        : bytes(_mm_loadu_si128(reinterpret_cast<const __m128i*>(control))) {}
+
+    uint32_t match(int8_t control) const
+    {
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_set1_epi8(control), bytes)));
+    }
+
+    uint32_t match_free() const
+    {
+        return static_cast<uint32_t>(_mm_movemask_epi8(_mm_cmpgt_epi8(_mm_set1_epi8(-1), bytes)));
+    }
+#else
+    const int8_t* bytes;
+
+    explicit ControlGroup(const int8_t* control) : bytes(control) {}
+
+    uint32_t match(int8_t control) const
+    {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < MapObj::GROUP_WIDTH; ++i)
+            mask |= static_cast<uint32_t>(bytes[i] == control) << i;
+        return mask;
+    }
+
+    uint32_t match_free() const
+    {
+        uint32_t mask = 0;
+        for (size_t i = 0; i < MapObj::GROUP_WIDTH; ++i)
+            mask |= static_cast<uint32_t>(bytes[i] < -1) << i;
+        return mask;
+    }
+#endif
+};
+
+static inline size_t lowest_bit(uint32_t mask)
+{
+#if defined(__GNUC__)
+    return static_cast<size_t>(__builtin_ctz(mask));
+#else
+    size_t bit = 0;
+    while ((mask & 1u) == 0) {
+        mask >>= 1;
+        ++bit;
+    }
+    return bit;
+#endif
+}
+
+static size_t hash_of(const Value& key)
+{
+    uint64_t hash;
+    if (const double* number = std::get_if<double>(&key)) {
+        // 0.0 and -0.0 are the same key.
+        const double normalized = *number == 0 ? 0.0 : *number;
+        std::memcpy(&hash, &normalized, sizeof(hash));
+    } else if (const bool* boolean = std::get_if<bool>(&key)) {
+        hash = *boolean ? 0x9E3779B97F4A7C15ULL : 0x7F4A7C159E3779B9ULL;
+    } else {
+        hash = std::hash<std::string_view>()(as_string(key));
+    }
+
+    // Spread the bits, the low 7 go to the control byte.
+    hash ^= hash >> 33;
+    hash *= 0xFF51AFD7ED558CCDULL;
+    hash ^= hash >> 33;
+    return static_cast<size_t>(hash);
+}
+
+static inline int8_t control_of(size_t hash)
+{
+    return static_cast<int8_t>(hash & 0x7F);
+}
+
+bool MapObj::is_hashable(const Value& key)
+{
+    if (const double* number = std::get_if<double>(&key))
+        return !std::isnan(*number);
+    return std::holds_alternative<bool>(key) || is_string(key);
+}
+
+size_t MapObj::find_slot(const Value& key, size_t hash) const
+{
+    if (capacity == 0)
+        return NOT_FOUND;
+
+    const size_t mask = capacity - 1;
+    size_t position = (hash >> 7) & mask;
+    for (size_t step = GROUP_WIDTH;; step += GROUP_WIDTH) {
+        const ControlGroup group(&control[position]);
+        for (uint32_t match = group.match(control_of(hash)); match != 0; match &= match - 1) {
+            const size_t slot = (position + lowest_bit(match)) & mask;
+            const Entry& entry = entries[slots[slot]];
+            if (entry.hash == hash && values_equal(entry.key, key))
+                return slot;
+        }
+        if (group.match(EMPTY) != 0)
+            return NOT_FOUND;
+        position = (position + step) & mask;
+    }
+}
+
+size_t MapObj::find_free_slot(size_t hash) const
+{
+    const size_t mask = capacity - 1;
+    size_t position = (hash >> 7) & mask;
+    for (size_t step = GROUP_WIDTH;; step += GROUP_WIDTH) {
+        const uint32_t free = ControlGroup(&control[position]).match_free();
+        if (free != 0)
+            return (position + lowest_bit(free)) & mask;
+        position = (position + step) & mask;
+    }
+}
+
+void MapObj::set_control(size_t slot, int8_t value)
+{
+    control[slot] = value;
+    if (slot < GROUP_WIDTH)
+        control[capacity + slot] = value;
+}
+
+void MapObj::rehash(size_t new_capacity)
+{
+    // Drop removed entries, keeping the insertion order of the others.
+    entries.erase(std::remove_if(entries.begin(), entries.end(), [](const Entry& entry) {
+        return std::holds_alternative<std::monostate>(entry.key);
+    }), entries.end());
+
+    capacity = new_capacity;
+    control.assign(capacity + GROUP_WIDTH, EMPTY);
+    slots.assign(capacity, 0);
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const size_t slot = find_free_slot(entries[i].hash);
+        set_control(slot, control_of(entries[i].hash));
+        slots[slot] = static_cast<uint32_t>(i);
+    }
+    growth_left = capacity * 7 / 8 - count;
+    removed = 0;
+}
+
+Value* MapObj::find(const Value& key)
+{
+    const size_t slot = find_slot(key, hash_of(key));
+    return slot == NOT_FOUND ? nullptr : &entries[slots[slot]].value;
+}
+
+const Value* MapObj::find(const Value& key) const
+{
+    const size_t slot = find_slot(key, hash_of(key));
+    return slot == NOT_FOUND ? nullptr : &entries[slots[slot]].value;
+}
+
+void MapObj::insert(const Value& key, Value value)
+{
+    const size_t hash = hash_of(key);
+    const size_t existing = find_slot(key, hash);
+    if (existing != NOT_FOUND) {
+        entries[slots[existing]].value = std::move(value);
+        return;
+    }
+
+    // Deleted slots count against the load factor, so a table full of
+    // them is rebuilt at the same size. Removed entries are dropped by the
+    // rebuild too, which happens early once they outnumber the live ones.
+    if (growth_left == 0 || removed > count) {
+        size_t new_capacity = GROUP_WIDTH;
+        while (new_capacity * 7 / 8 < (count + 1) * 2)
+            new_capacity *= 2;
+        rehash(new_capacity);
+    }
+
+    const size_t slot = find_free_slot(hash);
+    if (control[slot] == EMPTY)
+        --growth_left;
+    set_control(slot, control_of(hash));
+    slots[slot] = static_cast<uint32_t>(entries.size());
+    entries.push_back({ key, std::move(value), hash });
+    ++count;
+}
+
+bool MapObj::remove(const Value& key)
+{
+    const size_t slot = find_slot(key, hash_of(key));
+    if (slot == NOT_FOUND)
+        return false;
+
+    Entry& entry = entries[slots[slot]];
+    entry.key = std::monostate();
+    entry.value = std::monostate();
+    set_control(slot, DELETED);
+    --count;
+    ++removed;
+    return true;
+}
+
+void OutputVisitor::operator()(const Map& m) const
+{
+    bool first = true;
+    std::cout << "{ ";
+    m->for_each([&](const Value& key, const Value& value) {
+        if (!first)
+            std::cout << ", ";
+        first = false;
+        std::cout << key;
+        if (!m->is_set)
+            std::cout << ": " << value;
+    });
+    std::cout << " }";
+}
@@ -12,7 +12,7 @@ namespace stdlib {
 			}
 
 			try {
-				const auto& str = std::get<std::string>(*args);
+				const std::string str(as_string(*args));
 				return static_cast<double>(std::puts(str.c_str()));
 			}
 			catch (std::bad_variant_access&) {
@@ -29,7 +29,7 @@ namespace stdlib {
 			}
 
 			try {
-				const auto& str = std::get<std::string>(*args);
+				const auto str = as_string(*args);
 				const auto& stream = std::get<FILE*>(*(args + 1));
 
 				if (nullptr == stream) {
@@ -57,7 +57,7 @@ namespace stdlib {
 			}
 
 			try {
-				const auto& str = std::get<std::string>(*args);
+				const auto str = as_string(*args);
 
 				if (str.length() > 1) {
 					fmt::print(stderr, "Error: putchar(char) expects a single char argument!\n");
@@ -1,6 +1,115 @@
 #include "provider/earray.h"
+#include "provider/estring.h"
+#include "runtime/core_vm.h"
+#include "runtime/sort.h"
 
 namespace stdlib {
+    /**
+     * @brief Read the optional element kind argument of the typed array
+     * constructors, f64 when omitted.
+    */
+    static std::optional<ElementKind> kind_argument(int argc, int position, std::vector<Value>::iterator args)
+    {
+        if (argc <= position)
+            return ElementKind::F64;
+
+        std::optional<ElementKind> kind;
+        if (is_string(*(args + position)))
+            kind = TypedArrayObj::parse_kind(as_string(*(args + position)));
+        if (!kind)
+            fmt::print(stderr, "Error: element kind must be one of \"f64\", \"i64\", \"i32\" or \"u8\".\n");
+        return kind;
+    }
+
+    /**
+     * @brief Natural order used by sort and bsearch: numbers, then strings.
+    */
+    static bool value_less(const Value& a, const Value& b)
+    {
+        const double* number_a = std::get_if<double>(&a);
+        const double* number_b = std::get_if<double>(&b);
+        if (number_a != nullptr && number_b != nullptr)
+            return *number_a < *number_b;
+        if (is_string(a) && is_string(b))
+            return as_string(a) < as_string(b);
+        return number_a != nullptr && is_string(b);
+    }
+
+    /**
+     * @brief Resolve a possibly negative index against a length,
+     * clamping the result to [0, length].
+    */
+    static size_t clamp_index(double index, size_t length)
+    {
+        if (index < 0)
+            index += static_cast<double>(length);
+        return static_cast<size_t>(std::clamp(index, 0.0, static_cast<double>(length)));
+    }
+
+    /**
+     * @brief Read an array or typed array of numbers for a reduction.
+    */
+    static bool numbers_argument(const Value& value, NumericView& view, const char* name)
+    {
+        if (!is_array_operand(value) || view_numbers(value, view) != nullptr) {
+            fmt::print(stderr, "Error: {}(arr) expects an array of numbers.\n", name);
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Reduce an array of numbers, null when it is empty.
+    */
+    static Value reduction(int argc, std::vector<Value>::iterator args, const char* name,
+                           double (*reduce)(const double*, size_t))
+    {
+        if (argc != 1) {
+            fmt::print(stderr, "Error: {}(arr) expects 1 parameter. Got {}.\n", name, argc);
+            return std::monostate();
+        }
+
+        NumericView view;
+        if (!numbers_argument(*args, view, name) || view.size == 0)
+            return std::monostate();
+        return reduce(view.data, view.size);
+    }
+
+    Value array_min(int argc, std::vector<Value>::iterator args)
+    {
+        return reduction(argc, args, "min", minimum);
+    }
+
+    Value array_max(int argc, std::vector<Value>::iterator args)
+    {
+        return reduction(argc, args, "max", maximum);
+    }
+
+    Value array_sum(int argc, std::vector<Value>::iterator args)
+    {
+        if (argc != 1) {
+            fmt::print(stderr, "Error: sum(arr) expects 1 parameter. Got {}.\n", argc);
+            return std::monostate();
+        }
+
+        NumericView view;
+        if (!numbers_argument(*args, view, "sum"))
+            return std::monostate();
+        return sum(view.data, view.size);
+    }
+
+    /**
+     * @brief Read a non negative size argument.
+    */
+    static std::optional<size_t> size_argument(const Value& value)
+    {
+        const double* size = std::get_if<double>(&value);
+        if (size == nullptr || *size < 0) {
+            fmt::print(stderr, "Error: array size must be a non negative number.\n");
+            return std::nullopt;
+        }
+        return static_cast<size_t>(*size);
+    }
     EArray::EArray()
     : ELibrary({
 
@@ -12,12 +121,24 @@ namespace stdlib {
                     return std::monostate();
                 }
 
+                if (const TypedArray* typed = std::get_if<TypedArray>(&*args)) {
+                    for (int i = 1; i < argc; ++i) {
+                        if (!std::holds_alternative<double>(*(args + i))) {
+                            fmt::print(stderr, "Error: typed arrays can only hold numbers.\n");
+                            return std::monostate();
+                        }
+                    }
+                    for (int i = 1; i < argc; ++i)
+                        (*typed)->push(std::get<double>(*(args + i)));
+                    return *(args + 1);
+                }
+
                 // getting array
                 try {
                     Array array = std::get<Array>(*args);
-                    // inserting elements into array
-                    for (int i = 1; i < argc; ++i)
-                        array->values.push_back(*(args + i));
+                    // inserting all the elements at once
+                    ArrayObj::Storage& values = array->resizable();
+                    values.insert(values.end(), args + 1, args + argc);
                     return *(args + 1);
                 }
                 catch (std::bad_variant_access&) {
@@ -26,21 +147,173 @@ namespace stdlib {
 				}
             }},
             { "pop", [](int argc, std::vector<Value>::iterator args) -> Value {
-                if (argc < 2) {
-                    fmt::print(stderr, "Error: push(arr, [items...]) expects 1 parameter. Got {}.\n", argc);
+                if (argc != 1) {
+                    fmt::print(stderr, "Error: pop(arr) expects 1 parameter. Got {}.\n", argc);
                     return std::monostate();
                 }
 
                 try {
                     Array array = std::get<Array>(*args);
-                    array->values.pop_back();
+                    ArrayObj::Storage& values = array->resizable();
+                    if (values.empty())
+                        return std::monostate();
 
-                    return *(args + 1);
+                    Value last = std::move(values.back());
+                    values.pop_back();
+                    return last;
                 }
                 catch (std::bad_variant_access&) {
-                    fmt::print(stderr, "Error: push(arr, item) works only on array types!\n");
+                    fmt::print(stderr, "Error: pop(arr) works only on array types!\n");
+                    return std::monostate();
+                }
+            }},
+            { "array", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc < 1 || argc > 2) {
+                    fmt::print(stderr, "Error: array(n, [value]) expects 1 or 2 parameters. Got {}.\n", argc);
                     return std::monostate();
                 }
+
+                const std::optional<size_t> size = size_argument(*args);
+                if (!size)
+                    return std::monostate();
+                const Value value = argc == 2 ? *(args + 1) : Value(std::monostate());
+                return std::make_shared<ArrayObj>(ArrayObj::Storage(*size, value));
+            }},
+            { "reserve", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 2) {
+                    fmt::print(stderr, "Error: reserve(arr, n) expects 2 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                const std::optional<size_t> size = size_argument(*(args + 1));
+                if (!size)
+                    return std::monostate();
+
+                if (const TypedArray* typed = std::get_if<TypedArray>(&*args)) {
+                    std::visit([&size](auto& values) { values.reserve(*size); }, (*typed)->elements);
+                    return *args;
+                }
+
+                try {
+                    std::get<Array>(*args)->resizable().reserve(*size);
+                    return *args;
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is array.\n");
+                    return std::monostate();
+                }
+            }},
+            { "capacity", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 1) {
+                    fmt::print(stderr, "Error: capacity(arr) expects 1 parameter. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                if (const TypedArray* typed = std::get_if<TypedArray>(&*args)) {
+                    return std::visit([](const auto& values) {
+                        return static_cast<double>(values.capacity());
+                    }, (*typed)->elements);
+                }
+
+                try {
+                    return static_cast<double>(std::get<Array>(*args)->capacity());
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is array.\n");
+                    return std::monostate();
+                }
+            }},
+            { "truncate", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 2) {
+                    fmt::print(stderr, "Error: truncate(arr, n) expects 2 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                const std::optional<size_t> size = size_argument(*(args + 1));
+                if (!size)
+                    return std::monostate();
+
+                if (const TypedArray* typed = std::get_if<TypedArray>(&*args)) {
+                    std::visit([&size](auto& values) {
+                        if (*size < values.size())
+                            values.resize(*size);
+                    }, (*typed)->elements);
+                    return *args;
+                }
+
+                try {
+                    Array array = std::get<Array>(*args);
+                    if (*size < array->size())
+                        array->resizable().resize(*size);
+                    return array;
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is array.\n");
+                    return std::monostate();
+                }
+            }},
+            { "extend", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc < 2) {
+                    fmt::print(stderr, "Error: extend(arr, [arrays...]) expects at least 2 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                for (int i = 0; i < argc; ++i) {
+                    if (!is_array_operand(*(args + i))) {
+                        fmt::print(stderr, "Error: extend(arr, [arrays...]) expects arrays.\n");
+                        return std::monostate();
+                    }
+                }
+
+                if (const TypedArray* typed = std::get_if<TypedArray>(&*args)) {
+                    // check everything first, so that a failure leaves the array as it was
+                    std::vector<NumericView> sources(argc - 1);
+                    size_t total = (*typed)->size();
+                    for (int i = 1; i < argc; ++i) {
+                        if (view_numbers(*(args + i), sources[i - 1]) != nullptr) {
+                            fmt::print(stderr, "Error: typed arrays can only hold numbers.\n");
+                            return std::monostate();
+                        }
+                        total += sources[i - 1].size;
+                    }
+
+                    // a typed array extended with itself is read before growing
+                    std::visit([&](auto& values) {
+                        using T = typename std::decay_t<decltype(values)>::value_type;
+                        std::vector<T> incoming;
+                        incoming.reserve(total - values.size());
+                        for (const NumericView& source : sources) {
+                            for (size_t j = 0; j < source.size; ++j)
+                                incoming.push_back(TypedArrayObj::convert<T>(source.data[j]));
+                        }
+                        values.insert(values.end(), incoming.begin(), incoming.end());
+                    }, (*typed)->elements);
+                    return *args;
+                }
+
+                Array array = std::get<Array>(*args);
+                ArrayObj::Storage& values = array->resizable();
+                size_t total = values.size();
+                for (int i = 1; i < argc; ++i) {
+                    const Value& source = *(args + i);
+                    total += std::holds_alternative<Array>(source) ? std::get<Array>(source)->size()
+                                                                   : std::get<TypedArray>(source)->size();
+                }
+
+                // no reallocation below, so sources viewing the array itself stay valid
+                values.reserve(total);
+                for (int i = 1; i < argc; ++i) {
+                    if (const Array* other = std::get_if<Array>(&*(args + i))) {
+                        const size_t size = (*other)->size();
+                        for (size_t j = 0; j < size; ++j)
+                            values.push_back((*other)->get(j));
+                    } else {
+                        const TypedArray& typed = std::get<TypedArray>(*(args + i));
+                        for (size_t j = 0; j < typed->size(); ++j)
+                            values.push_back(typed->get(j));
+                    }
+                }
+                return array;
             }},
             { "len", [](int argc, std::vector<Value>::iterator args) -> Value {
                 if (argc > 1 || argc < 1) {
@@ -48,15 +321,485 @@ namespace stdlib {
                     return std::monostate();
                 }
 
+                if (is_string(*args))
+                    return static_cast<double>(as_string(*args).size());
+                if (const TypedArray* typed = std::get_if<TypedArray>(&*args))
+                    return static_cast<double>((*typed)->size());
+
                 try {
                     Array array = std::get<Array>(*args);
-                    return static_cast<double>(array->values.size());
+                    return static_cast<double>(array->size());
                 }
                 catch (std::bad_variant_access&) {
                     fmt::print(stderr, "Error: expected type is array.\n");
 					return std::monostate();
 				}
             }},
+            { "zeros", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc < 1 || argc > 2) {
+                    fmt::print(stderr, "Error: zeros(n, [kind]) expects 1 or 2 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                const std::optional<size_t> size = size_argument(*args);
+                const std::optional<ElementKind> kind = kind_argument(argc, 1, args);
+                if (!size || !kind)
+                    return std::monostate();
+                return std::make_shared<TypedArrayObj>(*kind, *size);
+            }},
+            { "fill", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc < 2 || argc > 4) {
+                    fmt::print(stderr, "Error: fill(n, value, [kind]) or fill(arr, value, [begin, [end]]) expects 2 to 4 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                // fill(arr, value, [begin, [end]]) fills in place
+                if (is_array_operand(*args)) {
+                    try {
+                        const Value& value = *(args + 1);
+                        const size_t size = std::holds_alternative<Array>(*args) ? std::get<Array>(*args)->size()
+                                                                                  : std::get<TypedArray>(*args)->size();
+                        const size_t begin = argc > 2 ? clamp_index(std::get<double>(*(args + 2)), size) : 0;
+                        const size_t end = argc > 3 ? clamp_index(std::get<double>(*(args + 3)), size) : size;
+
+                        if (const Array* array = std::get_if<Array>(&*args)) {
+                            if (begin < end) {
+                                Value* values = (*array)->mutable_data();
+                                std::fill(values + begin, values + end, value);
+                            }
+                        } else {
+                            const double number = std::get<double>(value);
+                            std::visit([&](auto& values) {
+                                using T = typename std::decay_t<decltype(values)>::value_type;
+                                if (begin < end)
+                                    std::fill(values.begin() + begin, values.begin() + end, TypedArrayObj::convert<T>(number));
+                            }, std::get<TypedArray>(*args)->elements);
+                        }
+                        return *args;
+                    }
+                    catch (std::bad_variant_access&) {
+                        fmt::print(stderr, "Error: fill(arr, value, [begin, [end]]) expects numeric bounds and a number for typed arrays.\n");
+                        return std::monostate();
+                    }
+                }
+
+                if (argc > 3) {
+                    fmt::print(stderr, "Error: fill(n, value, [kind]) expects 2 or 3 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                const std::optional<size_t> size = size_argument(*args);
+                const std::optional<ElementKind> kind = kind_argument(argc, 2, args);
+                if (!size || !kind)
+                    return std::monostate();
+
+                try {
+                    return std::make_shared<TypedArrayObj>(*kind, *size, std::get<double>(*(args + 1)));
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: typed arrays can only hold numbers.\n");
+                    return std::monostate();
+                }
+            }},
+            { "fromArray", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc < 1 || argc > 2) {
+                    fmt::print(stderr, "Error: fromArray(arr, [kind]) expects 1 or 2 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                const std::optional<ElementKind> kind = kind_argument(argc, 1, args);
+                if (!kind)
+                    return std::monostate();
+
+                try {
+                    Array array = std::get<Array>(*args);
+                    TypedArray result = std::make_shared<TypedArrayObj>(*kind, array->size());
+                    for (size_t i = 0; i < array->size(); ++i)
+                        result->set(i, std::get<double>(array->get(i)));
+                    return result;
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: fromArray(arr, [kind]) expects an array of numbers.\n");
+                    return std::monostate();
+                }
+            }},
+            { "toArray", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 1) {
+                    fmt::print(stderr, "Error: toArray(typed) expects 1 parameter. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    TypedArray typed = std::get<TypedArray>(*args);
+                    ArrayObj::Storage values;
+                    values.reserve(typed->size());
+                    for (size_t i = 0; i < typed->size(); ++i)
+                        values.push_back(typed->get(i));
+                    return std::make_shared<ArrayObj>(std::move(values));
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is typed array.\n");
+                    return std::monostate();
+                }
+            }},
+            { "sort", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 1) {
+                    fmt::print(stderr, "Error: sort(arr) expects 1 parameter. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                if (const TypedArray* typed = std::get_if<TypedArray>(&*args)) {
+                    std::visit([](auto& values) { sort::radix_sort(values); }, (*typed)->elements);
+                    return *args;
+                }
+
+                try {
+                    Array array = std::get<Array>(*args);
+
+                    const bool numbers = std::all_of(array->begin(), array->end(), [](const Value& v) {
+                        return std::holds_alternative<double>(v);
+                    });
+                    if (numbers) {
+                        // sort unboxed numbers, then box them back
+                        std::vector<double> keys;
+                        keys.reserve(array->size());
+                        for (const Value& value : *array)
+                            keys.push_back(std::get<double>(value));
+                        sort::radix_sort(keys);
+                        std::copy(keys.begin(), keys.end(), array->mutable_data());
+                        return array;
+                    }
+
+                    if (!std::all_of(array->begin(), array->end(), is_string)) {
+                        fmt::print(stderr, "Error: sort(arr) sorts numbers or strings, use sortBy(arr, cmp) for other values.\n");
+                        return std::monostate();
+                    }
+                    Value* values = array->mutable_data();
+                    sort::pdqsort(values, values + array->size(), [](const Value& a, const Value& b) {
+                        return as_string(a) < as_string(b);
+                    });
+                    return array;
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is array.\n");
+                    return std::monostate();
+                }
+            }},
+            { "bsearch", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 2) {
+                    fmt::print(stderr, "Error: bsearch(arr, value) expects 2 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                const Value& target = *(args + 1);
+                if (const TypedArray* typed = std::get_if<TypedArray>(&*args)) {
+                    const double* number = std::get_if<double>(&target);
+                    if (number == nullptr)
+                        return -1.0;
+                    return std::visit([number](const auto& values) -> Value {
+                        auto found = std::lower_bound(values.begin(), values.end(), *number,
+                            [](const auto& item, double key) { return static_cast<double>(item) < key; });
+                        if (found == values.end() || static_cast<double>(*found) != *number)
+                            return -1.0;
+                        return static_cast<double>(found - values.begin());
+                    }, (*typed)->elements);
+                }
+
+                try {
+                    const Array& array = std::get<Array>(*args);
+                    const Value* found = std::lower_bound(array->begin(), array->end(), target, value_less);
+                    if (found == array->end() || !values_equal(*found, target))
+                        return -1.0;
+                    return static_cast<double>(found - array->begin());
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is array.\n");
+                    return std::monostate();
+                }
+            }},
+            { "indexOf", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc >= 1 && is_string(*args))
+                    return string_find(argc, args);
+
+                if (argc < 2 || argc > 3) {
+                    fmt::print(stderr, "Error: indexOf(arr, value, [from]) expects 2 or 3 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    const Value& target = *(args + 1);
+                    const double from = argc == 3 ? std::get<double>(*(args + 2)) : 0;
+
+                    if (const TypedArray* typed = std::get_if<TypedArray>(&*args)) {
+                        const double* number = std::get_if<double>(&target);
+                        if (number == nullptr)
+                            return -1.0;
+                        return std::visit([&](const auto& values) -> Value {
+                            for (size_t i = clamp_index(from, values.size()); i < values.size(); ++i) {
+                                if (static_cast<double>(values[i]) == *number)
+                                    return static_cast<double>(i);
+                            }
+                            return -1.0;
+                        }, (*typed)->elements);
+                    }
+
+                    const Array& array = std::get<Array>(*args);
+                    for (size_t i = clamp_index(from, array->size()); i < array->size(); ++i) {
+                        if (values_equal(array->get(i), target))
+                            return static_cast<double>(i);
+                    }
+                    return -1.0;
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: indexOf(arr, value, [from]) expects an array and a numeric start.\n");
+                    return std::monostate();
+                }
+            }},
+            { "reverse", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 1) {
+                    fmt::print(stderr, "Error: reverse(arr) expects 1 parameter. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                if (const TypedArray* typed = std::get_if<TypedArray>(&*args)) {
+                    std::visit([](auto& values) { std::reverse(values.begin(), values.end()); }, (*typed)->elements);
+                    return *args;
+                }
+
+                try {
+                    Array array = std::get<Array>(*args);
+                    Value* values = array->mutable_data();
+                    std::reverse(values, values + array->size());
+                    return array;
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is array.\n");
+                    return std::monostate();
+                }
+            }},
+            { "min", array_min },
+            { "max", array_max },
+            { "sum", array_sum },
+            { "mean", [](int argc, std::vector<Value>::iterator args) -> Value {
+                return reduction(argc, args, "mean", [](const double* data, size_t size) {
+                    return sum(data, size) / static_cast<double>(size);
+                });
+            }},
+            { "slice", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc >= 1 && is_string(*args))
+                    return string_slice(argc, args);
+
+                if (argc < 2 || argc > 3) {
+                    fmt::print(stderr, "Error: slice(arr, begin, [end]) expects 2 or 3 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    const size_t size = std::holds_alternative<TypedArray>(*args) ? std::get<TypedArray>(*args)->size()
+                                                                                 : std::get<Array>(*args)->size();
+                    const size_t begin = clamp_index(std::get<double>(*(args + 1)), size);
+                    const size_t end = std::max(begin, argc == 3 ? clamp_index(std::get<double>(*(args + 2)), size) : size);
+
+                    if (const TypedArray* typed = std::get_if<TypedArray>(&*args)) {
+                        TypedArray result = std::make_shared<TypedArrayObj>((*typed)->kind(), 0);
+                        std::visit([&](const auto& values) {
+                            using Vector = std::decay_t<decltype(values)>;
+                            result->elements = Vector(values.begin() + begin, values.begin() + end);
+                        }, (*typed)->elements);
+                        return result;
+                    }
+
+                    // a view, writes to it show in the array
+                    return ArrayObj::slice(std::get<Array>(*args), begin, end);
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: slice(arr, begin, [end]) expects an array and numeric bounds.\n");
+                    return std::monostate();
+                }
+            }},
+            { "copy", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 1) {
+                    fmt::print(stderr, "Error: copy(arr) expects 1 parameter. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                if (const TypedArray* typed = std::get_if<TypedArray>(&*args))
+                    return std::make_shared<TypedArrayObj>(**typed);
+
+                try {
+                    // shares the elements until either array is written
+                    return ArrayObj::copy(std::get<Array>(*args));
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is array.\n");
+                    return std::monostate();
+                }
+            }},
+            { "concat", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc < 1) {
+                    fmt::print(stderr, "Error: concat(arr, [arrays...]) expects at least 1 parameter. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                for (int i = 0; i < argc; ++i) {
+                    if (!is_array_operand(*(args + i))) {
+                        fmt::print(stderr, "Error: concat(arr, [arrays...]) expects arrays.\n");
+                        return std::monostate();
+                    }
+                }
+
+                // typed arrays of one kind stay typed
+                if (const TypedArray* first = std::get_if<TypedArray>(&*args)) {
+                    const bool same_kind = std::all_of(args, args + argc, [first](const Value& v) {
+                        const TypedArray* typed = std::get_if<TypedArray>(&v);
+                        return typed != nullptr && (*typed)->kind() == (*first)->kind();
+                    });
+                    if (same_kind) {
+                        TypedArray result = std::make_shared<TypedArrayObj>((*first)->kind(), 0);
+                        std::visit([&](auto& out) {
+                            using Vector = std::decay_t<decltype(out)>;
+                            for (int i = 0; i < argc; ++i) {
+                                const Vector& values = std::get<Vector>(std::get<TypedArray>(*(args + i))->elements);
+                                out.insert(out.end(), values.begin(), values.end());
+                            }
+                        }, result->elements);
+                        return result;
+                    }
+                }
+
+                ArrayObj::Storage values;
+                for (int i = 0; i < argc; ++i) {
+                    if (const Array* array = std::get_if<Array>(&*(args + i))) {
+                        values.insert(values.end(), (*array)->begin(), (*array)->end());
+                    } else {
+                        const TypedArray& typed = std::get<TypedArray>(*(args + i));
+                        for (size_t j = 0; j < typed->size(); ++j)
+                            values.push_back(typed->get(j));
+                    }
+                }
+                return std::make_shared<ArrayObj>(std::move(values));
+            }},
+        },
+
+        // Functions calling back into the VM
+        {
+            { "map", [](VirtualMachine& vm, int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 2) {
+                    fmt::print(stderr, "Error: map(arr, func) expects 2 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    Array array = std::get<Array>(*args);
+                    Value func = *(args + 1);
+                    ArrayObj::Storage values;
+                    values.reserve(array->size());
+
+                    // the callback may resize the array, so index it every time
+                    for (size_t i = 0; i < array->size(); ++i) {
+                        std::optional<Value> mapped = vm.call_function(func, { array->get(i) });
+                        if (!mapped)
+                            return std::monostate();
+                        values.push_back(std::move(*mapped));
+                    }
+                    return std::make_shared<ArrayObj>(std::move(values));
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is array.\n");
+                    return std::monostate();
+                }
+            }},
+            { "filter", [](VirtualMachine& vm, int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 2) {
+                    fmt::print(stderr, "Error: filter(arr, func) expects 2 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    Array array = std::get<Array>(*args);
+                    Value func = *(args + 1);
+                    ArrayObj::Storage values;
+
+                    for (size_t i = 0; i < array->size(); ++i) {
+                        Value item = array->get(i);
+                        std::optional<Value> keep = vm.call_function(func, { item });
+                        if (!keep)
+                            return std::monostate();
+                        if (!is_false(*keep))
+                            values.push_back(std::move(item));
+                    }
+                    return std::make_shared<ArrayObj>(std::move(values));
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is array.\n");
+                    return std::monostate();
+                }
+            }},
+            { "sortBy", [](VirtualMachine& vm, int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 2) {
+                    fmt::print(stderr, "Error: sortBy(arr, cmp) expects 2 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    Array array = std::get<Array>(*args);
+                    Value compare = *(args + 1);
+
+                    // cmp(a, b) returns a negative number (or true) when a goes first;
+                    // it may modify the array, so sort a copy
+                    ArrayObj::Storage values(array->begin(), array->end());
+                    bool failed = false;
+                    sort::pdqsort(values.begin(), values.end(), [&](const Value& a, const Value& b) {
+                        if (failed)
+                            return false;
+                        std::optional<Value> order = vm.call_function(compare, { a, b });
+                        if (!order) {
+                            failed = true;
+                            return false;
+                        }
+                        if (const double* number = std::get_if<double>(&*order))
+                            return *number < 0;
+                        return !is_false(*order);
+                    });
+                    if (failed)
+                        return std::monostate();
+                    if (array->size() != values.size()) {
+                        fmt::print(stderr, "Error: sortBy(arr, cmp) comparator resized the array.\n");
+                        return std::monostate();
+                    }
+
+                    std::move(values.begin(), values.end(), array->mutable_data());
+                    return array;
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is array.\n");
+                    return std::monostate();
+                }
+            }},
+            { "reduce", [](VirtualMachine& vm, int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 3) {
+                    fmt::print(stderr, "Error: reduce(arr, func, initial) expects 3 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    Array array = std::get<Array>(*args);
+                    Value func = *(args + 1);
+                    Value accumulator = *(args + 2);
+
+                    for (size_t i = 0; i < array->size(); ++i) {
+                        std::optional<Value> next = vm.call_function(func, { accumulator, array->get(i) });
+                        if (!next)
+                            return std::monostate();
+                        accumulator = std::move(*next);
+                    }
+                    return accumulator;
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is array.\n");
+                    return std::monostate();
+                }
+            }},
         },
 
         // Constants
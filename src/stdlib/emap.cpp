@@ -0,0 +1,173 @@
+#include "provider/emap.h"
+#include "runtime/map.h"
+
+namespace stdlib {
+    /**
+     * @brief Report an unhashable key, shared by all the map natives.
+    */
+    static bool expect_hashable(const Value& key)
+    {
+        if (!MapObj::is_hashable(key)) {
+            fmt::print(stderr, "Error: map keys must be numbers, strings or booleans.\n");
+            return false;
+        }
+        return true;
+    }
+
+    EMap::EMap()
+    : ELibrary({
+
+        // Functions
+        {
+            { "keys", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 1) {
+                    fmt::print(stderr, "Error: keys(map) expects 1 parameter. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    Map map = std::get<Map>(*args);
+                    ArrayObj::Storage keys;
+                    keys.reserve(map->size());
+                    map->for_each([&](const Value& key, const Value&) { keys.push_back(key); });
+                    return std::make_shared<ArrayObj>(std::move(keys));
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is map.\n");
+                    return std::monostate();
+                }
+            }},
+            { "values", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 1) {
+                    fmt::print(stderr, "Error: values(map) expects 1 parameter. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    Map map = std::get<Map>(*args);
+                    ArrayObj::Storage values;
+                    values.reserve(map->size());
+                    // the elements of a set are its keys
+                    map->for_each([&](const Value& key, const Value& value) {
+                        values.push_back(map->is_set ? key : value);
+                    });
+                    return std::make_shared<ArrayObj>(std::move(values));
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is map.\n");
+                    return std::monostate();
+                }
+            }},
+            { "has", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 2) {
+                    fmt::print(stderr, "Error: has(map, key) expects 2 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    Map map = std::get<Map>(*args);
+                    const Value& key = *(args + 1);
+                    return MapObj::is_hashable(key) && map->find(key) != nullptr;
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is map.\n");
+                    return std::monostate();
+                }
+            }},
+            { "get", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 3) {
+                    fmt::print(stderr, "Error: get(map, key, default) expects 3 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    Map map = std::get<Map>(*args);
+                    const Value& key = *(args + 1);
+                    const Value* value = MapObj::is_hashable(key) ? map->find(key) : nullptr;
+                    return value != nullptr ? *value : *(args + 2);
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is map.\n");
+                    return std::monostate();
+                }
+            }},
+            { "remove", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 2) {
+                    fmt::print(stderr, "Error: remove(map, key) expects 2 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    Map map = std::get<Map>(*args);
+                    const Value& key = *(args + 1);
+                    return MapObj::is_hashable(key) && map->remove(key);
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is map.\n");
+                    return std::monostate();
+                }
+            }},
+            { "size", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc != 1) {
+                    fmt::print(stderr, "Error: size(map) expects 1 parameter. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    return static_cast<double>(std::get<Map>(*args)->size());
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is map.\n");
+                    return std::monostate();
+                }
+            }},
+            { "set", [](int argc, std::vector<Value>::iterator args) -> Value {
+                // a single array argument gives the elements, arrays cannot be elements
+                Map set = std::make_shared<MapObj>(true);
+                auto add_all = [&set](auto begin, auto end) {
+                    for (auto item = begin; item != end; ++item) {
+                        if (!expect_hashable(*item))
+                            return false;
+                        set->insert(*item, true);
+                    }
+                    return true;
+                };
+
+                const bool added = argc == 1 && std::holds_alternative<Array>(*args)
+                    ? add_all(std::get<Array>(*args)->begin(), std::get<Array>(*args)->end())
+                    : add_all(args, args + argc);
+                if (!added)
+                    return std::monostate();
+                return set;
+            }},
+            { "add", [](int argc, std::vector<Value>::iterator args) -> Value {
+                if (argc < 2) {
+                    fmt::print(stderr, "Error: add(set, [items...]) expects at least 2 parameters. Got {}.\n", argc);
+                    return std::monostate();
+                }
+
+                try {
+                    Map set = std::get<Map>(*args);
+                    if (!set->is_set) {
+                        fmt::print(stderr, "Error: add(set, [items...]) works only on sets, assign map keys instead.\n");
+                        return std::monostate();
+                    }
+
+                    for (int i = 1; i < argc; ++i) {
+                        if (!expect_hashable(*(args + i)))
+                            return std::monostate();
+                        set->insert(*(args + i), true);
+                    }
+                    return set;
+                }
+                catch (std::bad_variant_access&) {
+                    fmt::print(stderr, "Error: expected type is set.\n");
+                    return std::monostate();
+                }
+            }},
+        },
+
+        // Constants
+        {}
+    }) {}
+}
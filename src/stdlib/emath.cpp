@@ -1,4 +1,6 @@
 #include "provider/emath.h"
+#include "provider/earray.h"
+#include "runtime/array_ops.h"
 
 #include <random>
 #include <cmath>
@@ -329,11 +331,13 @@ namespace stdlib {
                     fmt::print(stderr, "Error: expected at least 1 argument. Got {}.", argc);
                     return std::monostate();
                 }
+                if (argc == 1 && is_array_operand(*args))
+                    return array_max(argc, args);
                 try {
                     auto max = std::get<double>(*args);
                     for (int i = 0; i < argc; ++i)
                         if (std::get<double>(*(args + i)) > max)
-                            max = std::get<double>(*(args + 1));
+                            max = std::get<double>(*(args + i));
                     return max;
                 }
                 catch (std::bad_variant_access&) {
@@ -346,11 +350,13 @@ namespace stdlib {
                     fmt::print(stderr, "Error: expected at least 1 argument. Got {}.", argc);
                     return std::monostate();
                 }
+                if (argc == 1 && is_array_operand(*args))
+                    return array_min(argc, args);
                 try {
                     auto min = std::get<double>(*args);
                     for (int i = 0; i < argc; ++i)
                         if (std::get<double>(*(args + i)) < min)
-                            min = std::get<double>(*(args + 1));
+                            min = std::get<double>(*(args + i));
                     return min;
                 }
                 catch (std::bad_variant_access&) {
@@ -422,6 +428,8 @@ namespace stdlib {
                     fmt::print(stderr, "Error: expected at least 1 argument. Got {}", argc);
                     return std::monostate();
                 }
+                if (argc == 1 && is_array_operand(*args))
+                    return array_sum(argc, args);
                 double sumVal = 0;
                 try {
                     for (int i = 0; i < argc; ++i)
@@ -1,4 +1,5 @@
 #include "provider/estdio.h"
+#include "provider/strkernels.h"
 
 #include <optional>
 #include <cstdio>
@@ -33,7 +34,7 @@ namespace stdlib {
 		{ "read", [](int argc, std::vector<Value>::iterator args) -> Value {
 			if (argc > 0 && argc < 2) {
 				try {
-					const auto param = std::get<std::string>(*args);
+					const auto param = as_string(*args);
 					fmt::print("{}", param);
 				} catch (std::bad_variant_access&) {
 					fmt::print(stderr, "Error: expected type is string.\n");
@@ -62,8 +63,8 @@ namespace stdlib {
 				return std::monostate();
 			}
 			try {
-				auto name = std::get<std::string>(*args);
-				auto mode = std::get<std::string>(*(args + 1));
+				auto name = std::string(as_string(*args));
+				auto mode = std::string(as_string(*(args + 1)));
 
 				try {
 					auto file = std::make_shared<FileObj>(name, mode);
@@ -137,7 +138,14 @@ namespace stdlib {
 					return std::monostate();
 				}
 
-				return file_ptr->read_all();
+				// Slicing the content later on references this buffer,
+				// validated once here so text functions never rescan it.
+				auto content = std::make_shared<const std::string>(file_ptr->read_all());
+				Value result = make_substring(content, 0, content->size());
+				if (const Substring* sub = std::get_if<Substring>(&result)) {
+					(*sub)->encoding = kernels::classify(*content);
+				}
+				return result;
 			} catch (std::bad_variant_access&) {
 				fmt::print(stderr, "Error: expected type is {file}\n");
 				return std::monostate();
@@ -156,11 +164,16 @@ namespace stdlib {
 					return std::monostate();
 				}
 
-				auto data = std::get<std::string>(*(args + 1));
-				file_ptr->write_all(data);
+				if (const double* num = std::get_if<double>(&*(args + 1))) {
+					char buffer[NUMBER_BUFFER_SIZE];
+					file_ptr->write_all(std::string_view(buffer, format_number(buffer, *num) - buffer));
+					return file_ptr;
+				}
+
+				file_ptr->write_all(as_string(*(args + 1)));
 				return file_ptr;
 			} catch (std::bad_variant_access&) {
-				fmt::print(stderr, "Error: expected types are {file} {string}\n");
+				fmt::print(stderr, "Error: expected types are {file} {string|number}\n");
 				return std::monostate();
 			}
 		}}
@@ -0,0 +1,609 @@
+#include "provider/estring.h"
+#include "provider/strkernels.h"
+
+#include <algorithm>
+
+namespace stdlib {
+
+	/**
+	 * @brief Pieces of ASCII text are ASCII too, any other encoding must be
+	 * found again since a piece may be cut inside a multibyte sequence.
+	*/
+	static void inherit_encoding(Value& piece, TextEncoding encoding)
+	{
+		if (Substring* sub = std::get_if<Substring>(&piece); sub && encoding == TextEncoding::Ascii) {
+			(*sub)->encoding = TextEncoding::Ascii;
+		}
+	}
+
+	/**
+	 * @brief Cut a piece out of a string argument without copying it.
+	 * Substrings are sliced again; plain strings are moved into a shared
+	 * source for the piece, so str must be an argument slot of the call.
+	*/
+	static Value slice_of(Value& str, size_t offset, size_t length)
+	{
+		if (const Substring* sub = std::get_if<Substring>(&str)) {
+			Value piece = make_substring((*sub)->source, (*sub)->offset + offset, length);
+			inherit_encoding(piece, (*sub)->encoding);
+			return piece;
+		}
+		if (length < SubstringObj::MIN_LENGTH) {
+			return std::string(as_string(str).substr(offset, length));
+		}
+		auto source = std::make_shared<const std::string>(std::get<std::string>(std::move(str)));
+		return make_substring(source, offset, length);
+	}
+
+	/**
+	 * @brief Code point index lookups and measurements. ASCII text is indexed
+	 * by byte; multibyte substrings build an index once and then scan at most
+	 * INDEX_STRIDE code points per lookup; plain strings (short literals and
+	 * computed text) are scanned.
+	 *
+	 * Natives get a copy of their arguments, so nothing found about a plain
+	 * string outlives the call: every code point access on one classifies and
+	 * scans it again, O(n) per call. Loops over long plain strings should wrap
+	 * them once with utf8(str), which returns a substring keeping both.
+	*/
+	static TextEncoding encoding_of(const Value& str)
+	{
+		if (const Substring* sub = std::get_if<Substring>(&str)) {
+			if ((*sub)->encoding == TextEncoding::Unknown) {
+				(*sub)->encoding = kernels::classify((*sub)->view());
+			}
+			return (*sub)->encoding;
+		}
+		return kernels::classify(as_string(str));
+	}
+
+	static inline bool is_leading_byte(char byte)
+	{
+		return (static_cast<unsigned char>(byte) & 0xC0) != 0x80;
+	}
+
+	static void build_index(const SubstringObj& sub)
+	{
+		if (!sub.code_point_index.empty()) {
+			return;
+		}
+
+		const auto text = sub.view();
+		size_t count = 0;
+		sub.code_point_index.reserve(text.size() / SubstringObj::INDEX_STRIDE + 1);
+		for (size_t i = 0; i < text.size(); ++i) {
+			if (is_leading_byte(text[i])) {
+				if (count % SubstringObj::INDEX_STRIDE == 0) {
+					sub.code_point_index.push_back(i);
+				}
+				++count;
+			}
+		}
+		sub.code_points = count;
+	}
+
+	static size_t code_point_length(const Value& str, TextEncoding encoding)
+	{
+		if (encoding == TextEncoding::Ascii) {
+			return as_string(str).size();
+		} else if (const Substring* sub = std::get_if<Substring>(&str)) {
+			build_index(**sub);
+			return (*sub)->code_points;
+		}
+		return kernels::count_code_points(as_string(str));
+	}
+
+	/**
+	 * @brief Byte offset of a code point, the byte length for the index one
+	 * past the end and npos further on.
+	*/
+	static size_t byte_offset(const Value& str, TextEncoding encoding, size_t index)
+	{
+		const auto text = as_string(str);
+		if (encoding == TextEncoding::Ascii) {
+			return index <= text.size() ? index : std::string_view::npos;
+		}
+
+		size_t offset = 0;
+		size_t skip = index;
+		if (const Substring* sub = std::get_if<Substring>(&str)) {
+			build_index(**sub);
+			if (index >= (*sub)->code_points) {
+				return index == (*sub)->code_points ? text.size() : std::string_view::npos;
+			}
+			offset = (*sub)->code_point_index[index / SubstringObj::INDEX_STRIDE];
+			skip = index % SubstringObj::INDEX_STRIDE;
+		}
+
+		for (; offset < text.size(); ++offset) {
+			if (is_leading_byte(text[offset])) {
+				if (skip == 0) {
+					return offset;
+				}
+				--skip;
+			}
+		}
+		return skip == 0 ? text.size() : std::string_view::npos;
+	}
+
+	/**
+	 * @brief Check that a string argument is valid UTF-8, reporting it otherwise.
+	*/
+	static bool expect_utf8(TextEncoding encoding, std::string_view function)
+	{
+		if (encoding == TextEncoding::Invalid) {
+			fmt::print(stderr, "Error: {} expects a valid UTF-8 string.\n", function);
+			return false;
+		}
+		return true;
+	}
+
+	/**
+	 * @brief Resolve a possibly negative index against a string length,
+	 * clamping the result to [0, length].
+	*/
+	static size_t clamp_index(double index, size_t length)
+	{
+		if (index < 0) {
+			index += static_cast<double>(length);
+		}
+		return static_cast<size_t>(std::clamp(index, 0.0, static_cast<double>(length)));
+	}
+
+	Value string_slice(int argc, std::vector<Value>::iterator args)
+	{
+		if (argc < 2 || argc > 3) {
+			fmt::print(stderr, "Error: slice(str, begin, [end]) expects 2 or 3 arguments. Got {}.\n", argc);
+			return std::monostate();
+		}
+
+		try {
+			const auto str = as_string(*args);
+			const size_t begin = clamp_index(std::get<double>(*(args + 1)), str.size());
+			size_t end = str.size();
+			if (argc == 3) {
+				end = clamp_index(std::get<double>(*(args + 2)), str.size());
+			}
+			return slice_of(*args, begin, end > begin ? end - begin : 0);
+		}
+		catch (std::bad_variant_access&) {
+			fmt::print(stderr, "Error: slice(str, begin, [end]) expects a string and numeric bounds.\n");
+			return std::monostate();
+		}
+	}
+
+	Value string_find(int argc, std::vector<Value>::iterator args)
+	{
+		if (argc < 2 || argc > 3) {
+			fmt::print(stderr, "Error: find(str, needle, [from]) expects 2 or 3 arguments. Got {}.\n", argc);
+			return std::monostate();
+		}
+
+		try {
+			const auto str = as_string(*args);
+			const auto needle = as_string(*(args + 1));
+			size_t from = 0;
+			if (argc == 3) {
+				from = clamp_index(std::get<double>(*(args + 2)), str.size());
+			}
+			const size_t found = kernels::find(str, needle, from);
+			return found == std::string_view::npos ? -1.0 : static_cast<double>(found);
+		}
+		catch (std::bad_variant_access&) {
+			fmt::print(stderr, "Error: find(str, needle, [from]) expects string arguments.\n");
+			return std::monostate();
+		}
+	}
+
+	/**
+	 * @brief Shared implementation of toUpper and toLower.
+	*/
+	static Value convert_case(int argc, std::vector<Value>::iterator args, void (*convert)(char*, size_t))
+	{
+		if (argc != 1) {
+			fmt::print(stderr, "Error: case conversion expects 1 argument. Got {}.\n", argc);
+			return std::monostate();
+		}
+
+		try {
+			std::string result(as_string(*args));
+			convert(result.data(), result.size());
+			return result;
+		}
+		catch (std::bad_variant_access&) {
+			fmt::print(stderr, "Error: case conversion expects a string argument.\n");
+			return std::monostate();
+		}
+	}
+
+	EString::EString() : ELibrary(
+		// Functions
+		{
+			{ "substr", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc < 2 || argc > 3) {
+					fmt::print(stderr, "Error: substr(str, start, [len]) expects 2 or 3 arguments. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					const auto str = as_string(*args);
+					const size_t start = clamp_index(std::get<double>(*(args + 1)), str.size());
+					size_t length = str.size() - start;
+					if (argc == 3) {
+						length = std::min(length, clamp_index(std::get<double>(*(args + 2)), length));
+					}
+					return slice_of(*args, start, length);
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: substr(str, start, [len]) expects a string and numeric bounds.\n");
+					return std::monostate();
+				}
+			}},
+
+			{ "charAt", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 2) {
+					fmt::print(stderr, "Error: charAt(str, index) expects 2 arguments. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					const auto str = as_string(*args);
+					const auto index = std::get<double>(*(args + 1));
+					if (index < 0 || index >= static_cast<double>(str.size())) {
+						return std::string();
+					}
+					return std::string(1, str[static_cast<size_t>(index)]);
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: charAt(str, index) expects a string and a numeric index.\n");
+					return std::monostate();
+				}
+			}},
+
+			{ "find", string_find },
+
+			{ "split", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 2) {
+					fmt::print(stderr, "Error: split(str, sep) expects 2 arguments. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					const auto separator = std::string(as_string(*(args + 1)));
+
+					// All the pieces share a single buffer, plain strings are copied once.
+					std::shared_ptr<const std::string> source;
+					size_t base = 0;
+					TextEncoding encoding = TextEncoding::Unknown;
+					if (const Substring* sub = std::get_if<Substring>(&*args)) {
+						source = (*sub)->source;
+						base = (*sub)->offset;
+						encoding = (*sub)->encoding;
+					} else {
+						source = std::make_shared<const std::string>(as_string(*args));
+					}
+					const auto str = as_string(*args);
+
+					Array result = std::make_shared<ArrayObj>();
+					ArrayObj::Storage& pieces = result->resizable();
+					if (separator.empty()) {
+						pieces.reserve(str.size());
+						for (size_t i = 0; i < str.size(); ++i) {
+							pieces.push_back(std::string(1, str[i]));
+						}
+						return result;
+					}
+
+					size_t start = 0;
+					for (size_t found = kernels::find(str, separator); found != std::string_view::npos;
+						 found = kernels::find(str, separator, start)) {
+						pieces.push_back(make_substring(source, base + start, found - start));
+						inherit_encoding(pieces.back(), encoding);
+						start = found + separator.size();
+					}
+					pieces.push_back(make_substring(source, base + start, str.size() - start));
+					inherit_encoding(pieces.back(), encoding);
+					return result;
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: split(str, sep) expects string arguments.\n");
+					return std::monostate();
+				}
+			}},
+			{ "count", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 2) {
+					fmt::print(stderr, "Error: count(str, needle) expects 2 arguments. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					return static_cast<double>(kernels::count(as_string(*args), as_string(*(args + 1))));
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: count(str, needle) expects string arguments.\n");
+					return std::monostate();
+				}
+			}},
+
+			{ "replace", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 3) {
+					fmt::print(stderr, "Error: replace(str, old, new) expects 3 arguments. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					const auto str = as_string(*args);
+					const auto pattern = as_string(*(args + 1));
+					const auto replacement = as_string(*(args + 2));
+					if (pattern.empty()) {
+						return *args;
+					}
+
+					size_t found = kernels::find(str, pattern);
+					if (found == std::string_view::npos) {
+						return *args;
+					}
+
+					std::string result;
+					result.reserve(str.size());
+					size_t start = 0;
+					for (; found != std::string_view::npos; found = kernels::find(str, pattern, start)) {
+						result.append(str.data() + start, found - start);
+						result.append(replacement);
+						start = found + pattern.size();
+					}
+					result.append(str.data() + start, str.size() - start);
+					return result;
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: replace(str, old, new) expects string arguments.\n");
+					return std::monostate();
+				}
+			}},
+
+			{ "trim", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 1) {
+					fmt::print(stderr, "Error: trim(str) expects 1 argument. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					constexpr std::string_view whitespace = " \t\n\v\f\r";
+					const auto str = as_string(*args);
+					const size_t begin = str.find_first_not_of(whitespace);
+					if (begin == std::string_view::npos) {
+						return std::string();
+					}
+					const size_t end = str.find_last_not_of(whitespace) + 1;
+					return slice_of(*args, begin, end - begin);
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: trim(str) expects a string argument.\n");
+					return std::monostate();
+				}
+			}},
+
+			{ "startsWith", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 2) {
+					fmt::print(stderr, "Error: startsWith(str, prefix) expects 2 arguments. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					const auto str = as_string(*args);
+					const auto prefix = as_string(*(args + 1));
+					return str.substr(0, prefix.size()) == prefix;
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: startsWith(str, prefix) expects string arguments.\n");
+					return std::monostate();
+				}
+			}},
+
+			{ "toUpper", [](int argc, std::vector<Value>::iterator args) -> Value {
+				return convert_case(argc, args, kernels::to_upper);
+			}},
+
+			{ "toLower", [](int argc, std::vector<Value>::iterator args) -> Value {
+				return convert_case(argc, args, kernels::to_lower);
+			}},
+			{ "isAscii", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 1) {
+					fmt::print(stderr, "Error: isAscii(str) expects 1 argument. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					return encoding_of(*args) == TextEncoding::Ascii;
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: isAscii(str) expects a string argument.\n");
+					return std::monostate();
+				}
+			}},
+
+			{ "isUtf8", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 1) {
+					fmt::print(stderr, "Error: isUtf8(str) expects 1 argument. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					return encoding_of(*args) != TextEncoding::Invalid;
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: isUtf8(str) expects a string argument.\n");
+					return std::monostate();
+				}
+			}},
+
+			{ "utf8", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 1) {
+					fmt::print(stderr, "Error: utf8(str) expects 1 argument. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					// Long computed strings become a view, whose code point index is kept.
+					Value text = *args;
+					if (std::holds_alternative<std::string>(text)) {
+						auto source = std::make_shared<const std::string>(std::get<std::string>(std::move(text)));
+						text = make_substring(source, 0, source->size());
+					}
+					if (!expect_utf8(encoding_of(text), "utf8(str)")) {
+						return std::monostate();
+					}
+					return text;
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: utf8(str) expects a string argument.\n");
+					return std::monostate();
+				}
+			}},
+
+			// ulen, ucharAt, ucodeAt and usubstr cost O(n) per call on plain
+			// strings, see encoding_of; utf8(str) makes them O(1) or O(INDEX_STRIDE).
+			{ "ulen", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 1) {
+					fmt::print(stderr, "Error: ulen(str) expects 1 argument. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					const TextEncoding encoding = encoding_of(*args);
+					if (!expect_utf8(encoding, "ulen(str)")) {
+						return std::monostate();
+					}
+					return static_cast<double>(code_point_length(*args, encoding));
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: ulen(str) expects a string argument.\n");
+					return std::monostate();
+				}
+			}},
+
+			{ "ucharAt", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 2) {
+					fmt::print(stderr, "Error: ucharAt(str, index) expects 2 arguments. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					const TextEncoding encoding = encoding_of(*args);
+					const auto index = std::get<double>(*(args + 1));
+					if (!expect_utf8(encoding, "ucharAt(str, index)")) {
+						return std::monostate();
+					}
+
+					const auto text = as_string(*args);
+					const size_t offset = index < 0 ? std::string_view::npos
+						: byte_offset(*args, encoding, static_cast<size_t>(index));
+					if (offset >= text.size()) {
+						return std::string();
+					}
+					return std::string(text.substr(offset, kernels::sequence_length(text, offset)));
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: ucharAt(str, index) expects a string and a numeric index.\n");
+					return std::monostate();
+				}
+			}},
+
+			{ "ucodeAt", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 2) {
+					fmt::print(stderr, "Error: ucodeAt(str, index) expects 2 arguments. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					const TextEncoding encoding = encoding_of(*args);
+					const auto index = std::get<double>(*(args + 1));
+					if (!expect_utf8(encoding, "ucodeAt(str, index)")) {
+						return std::monostate();
+					}
+
+					const auto text = as_string(*args);
+					const size_t offset = index < 0 ? std::string_view::npos
+						: byte_offset(*args, encoding, static_cast<size_t>(index));
+					if (offset >= text.size()) {
+						return std::monostate();
+					}
+
+					const size_t sequence = kernels::sequence_length(text, offset);
+					const auto lead = static_cast<unsigned char>(text[offset]);
+					uint32_t code_point = sequence == 1 ? lead : lead & (0x7F >> sequence);
+					for (size_t k = 1; k < sequence; ++k) {
+						code_point = (code_point << 6) | (static_cast<unsigned char>(text[offset + k]) & 0x3F);
+					}
+					return static_cast<double>(code_point);
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: ucodeAt(str, index) expects a string and a numeric index.\n");
+					return std::monostate();
+				}
+			}},
+
+			{ "usubstr", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc < 2 || argc > 3) {
+					fmt::print(stderr, "Error: usubstr(str, start, [len]) expects 2 or 3 arguments. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					const TextEncoding encoding = encoding_of(*args);
+					const auto start_arg = std::get<double>(*(args + 1));
+					if (!expect_utf8(encoding, "usubstr(str, start, [len])")) {
+						return std::monostate();
+					}
+
+					const size_t length = code_point_length(*args, encoding);
+					const size_t start = clamp_index(start_arg, length);
+					size_t end = length;
+					if (argc == 3) {
+						end = start + std::min(length - start, clamp_index(std::get<double>(*(args + 2)), length - start));
+					}
+
+					const size_t begin_byte = byte_offset(*args, encoding, start);
+					const size_t end_byte = byte_offset(*args, encoding, end);
+					return slice_of(*args, begin_byte, end_byte - begin_byte);
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: usubstr(str, start, [len]) expects a string and numeric bounds.\n");
+					return std::monostate();
+				}
+			}},
+
+			{ "uchars", [](int argc, std::vector<Value>::iterator args) -> Value {
+				if (argc != 1) {
+					fmt::print(stderr, "Error: uchars(str) expects 1 argument. Got {}.\n", argc);
+					return std::monostate();
+				}
+
+				try {
+					const TextEncoding encoding = encoding_of(*args);
+					if (!expect_utf8(encoding, "uchars(str)")) {
+						return std::monostate();
+					}
+
+					const auto text = as_string(*args);
+					Array result = std::make_shared<ArrayObj>();
+					ArrayObj::Storage& chars = result->resizable();
+					chars.reserve(code_point_length(*args, encoding));
+					for (size_t offset = 0; offset < text.size();) {
+						const size_t sequence = kernels::sequence_length(text, offset);
+						chars.push_back(std::string(text.substr(offset, sequence)));
+						offset += sequence;
+					}
+					return result;
+				}
+				catch (std::bad_variant_access&) {
+					fmt::print(stderr, "Error: uchars(str) expects a string argument.\n");
+					return std::monostate();
+				}
+			}},
+		},
+
+		// Constants
+		{}
+	) {}
+}
@@ -0,0 +1,448 @@
+#include "provider/strkernels.h"
+
+#include <cstring>
+#include <cstdlib>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+    #define ELY_KERNELS_AVX2
+#endif
+#if defined(__SSE2__) || defined(_M_X64)
+    #define ELY_KERNELS_SSE2
+#endif
+#if defined(ELY_KERNELS_AVX2) || defined(ELY_KERNELS_SSE2)
+    #include <immintrin.h>
+#endif
+
+namespace stdlib::kernels {
+
+/**
+ * @brief A set of kernels, picked once per process for the running CPU.
+*/
+struct KernelTable {
+    const char* name;
+    // Search a needle of at least two bytes.
+    size_t (*find)(const char* data, size_t length, const char* needle, size_t needle_length, size_t from);
+    // Search and count a single byte.
+    size_t (*find_byte)(const char* data, size_t length, char byte, size_t from);
+    size_t (*count_byte)(const char* data, size_t length, char byte);
+    // XOR the case bit of every byte within [lo, hi].
+    void (*flip_case)(char* data, size_t length, char lo, char hi);
+    size_t (*ascii_prefix)(const char* data, size_t length);
+    // Count the bytes that are not UTF-8 continuation bytes.
+    size_t (*count_leading_bytes)(const char* data, size_t length);
+};
+
+static inline unsigned count_trailing_zeros(unsigned mask)
+{
+#if defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_ctz(mask));
+#else
+    unsigned count = 0;
+    while ((mask & 1u) == 0) {
+        mask >>= 1;
+        ++count;
+    }
+    return count;
+#endif
+}
+
+static inline unsigned popcount(unsigned mask)
+{
+#if defined(__GNUC__)
+    return static_cast<unsigned>(__builtin_popcount(mask));
+#else
+    unsigned count = 0;
+    for (; mask != 0; mask &= mask - 1)
+        ++count;
+    return count;
+#endif
+}
+
+/* Scalar kernels, used for tails and on CPUs without vector units. */
+
+static size_t find_scalar(const char* data, size_t length, const char* needle, size_t needle_length, size_t from)
+{
+    return std::string_view(data, length).find(std::string_view(needle, needle_length), from);
+}
+
+static size_t find_byte_scalar(const char* data, size_t length, char byte, size_t from)
+{
+    const void* found = std::memchr(data + from, byte, length - from);
+    return found == nullptr ? std::string_view::npos : static_cast<const char*>(found) - data;
+}
+
+static size_t count_byte_scalar(const char* data, size_t length, char byte)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < length; ++i)
+        count += data[i] == byte;
+    return count;
+}
+
+static void flip_case_scalar(char* data, size_t length, char lo, char hi)
+{
+    for (size_t i = 0; i < length; ++i) {
+        if (data[i] >= lo && data[i] <= hi)
+            data[i] ^= 0x20;
+    }
+}
+
+static size_t ascii_prefix_scalar(const char* data, size_t length)
+{
+    size_t i = 0;
+    while (i < length && static_cast<unsigned char>(data[i]) < 0x80)
+        ++i;
+    return i;
+}
+
+static size_t count_leading_bytes_scalar(const char* data, size_t length)
+{
+    size_t count = 0;
+    for (size_t i = 0; i < length; ++i)
+        count += (static_cast<unsigned char>(data[i]) & 0xC0) != 0x80;
+    return count;
+}
+
+/*
+ * Vector kernels. Substring search compares the first and the last byte of
+ * the needle against a whole block at once and only verifies the positions
+ * where both match, which skips most of the haystack without branching.
+ * Case conversion shifts the letter range to the bottom of the signed byte
+ * range so that a single signed compare selects it. UTF-8 continuation
+ * bytes (0x80-0xBF) are exactly the signed bytes below -64.
+ */
+
+#ifdef ELY_KERNELS_SSE2
+static size_t find_sse2(const char* data, size_t length, const char* needle, size_t needle_length, size_t from)
+{
+    const __m128i first = _mm_set1_epi8(needle[0]);
+    const __m128i last = _mm_set1_epi8(needle[needle_length - 1]);
+
+    size_t i = from;
+    for (; i + needle_length - 1 + 16 <= length; i += 16) {
+        const __m128i block_first = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const __m128i block_last = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i + needle_length - 1));
+        unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(
+            _mm_and_si128(_mm_cmpeq_epi8(first, block_first), _mm_cmpeq_epi8(last, block_last))));
+        for (; mask != 0; mask &= mask - 1) {
+            const size_t candidate = i + count_trailing_zeros(mask);
+            if (std::memcmp(data + candidate + 1, needle + 1, needle_length - 2) == 0)
+                return candidate;
+        }
+    }
+    return find_scalar(data, length, needle, needle_length, i);
+}
+
+static size_t find_byte_sse2(const char* data, size_t length, char byte, size_t from)
+{
+    const __m128i pattern = _mm_set1_epi8(byte);
+
+    size_t i = from;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(_mm_cmpeq_epi8(pattern, block)));
+        if (mask != 0)
+            return i + count_trailing_zeros(mask);
+    }
+    return i < length ? find_byte_scalar(data, length, byte, i) : std::string_view::npos;
+}
+
+/**
+ * @brief Sum the 16 byte lanes of counts.
+*/
+static inline size_t sum_lanes_sse2(__m128i lanes)
+{
+    const __m128i sums = _mm_sad_epu8(lanes, _mm_setzero_si128());
+    return static_cast<size_t>(_mm_cvtsi128_si32(sums)) + static_cast<size_t>(_mm_cvtsi128_si32(_mm_srli_si128(sums, 8)));
+}
+
+static size_t count_byte_sse2(const char* data, size_t length, char byte)
+{
+    const __m128i pattern = _mm_set1_epi8(byte);
+
+    size_t count = 0;
+    size_t i = 0;
+    while (i + 16 <= length) {
+        // Matching lanes are -1, subtracting them counts per byte lane.
+        __m128i lanes = _mm_setzero_si128();
+        for (size_t blocks = 0; blocks < 255 && i + 16 <= length; ++blocks, i += 16) {
+            const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            lanes = _mm_sub_epi8(lanes, _mm_cmpeq_epi8(pattern, block));
+        }
+        count += sum_lanes_sse2(lanes);
+    }
+    return count + count_byte_scalar(data + i, length - i, byte);
+}
+
+static void flip_case_sse2(char* data, size_t length, char lo, char hi)
+{
+    const __m128i shift = _mm_set1_epi8(static_cast<char>(-128 - lo));
+    const __m128i limit = _mm_set1_epi8(static_cast<char>(-128 + (hi - lo) + 1));
+    const __m128i bit = _mm_set1_epi8(0x20);
+
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        __m128i* address = reinterpret_cast<__m128i*>(data + i);
+        const __m128i block = _mm_loadu_si128(address);
+        const __m128i in_range = _mm_cmplt_epi8(_mm_add_epi8(block, shift), limit);
+        _mm_storeu_si128(address, _mm_xor_si128(block, _mm_and_si128(in_range, bit)));
+    }
+    flip_case_scalar(data + i, length - i, lo, hi);
+}
+
+static size_t ascii_prefix_sse2(const char* data, size_t length)
+{
+    size_t i = 0;
+    for (; i + 16 <= length; i += 16) {
+        const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+        const unsigned mask = static_cast<unsigned>(_mm_movemask_epi8(block));
+        if (mask != 0)
+            return i + count_trailing_zeros(mask);
+    }
+    return i + ascii_prefix_scalar(data + i, length - i);
+}
+
+static size_t count_leading_bytes_sse2(const char* data, size_t length)
+{
+    const __m128i limit = _mm_set1_epi8(-64);
+
+    size_t continuations = 0;
+    size_t i = 0;
+    while (i + 16 <= length) {
+        __m128i lanes = _mm_setzero_si128();
+        for (size_t blocks = 0; blocks < 255 && i + 16 <= length; ++blocks, i += 16) {
+            const __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i*>(data + i));
+            lanes = _mm_sub_epi8(lanes, _mm_cmplt_epi8(block, limit));
+        }
+        continuations += sum_lanes_sse2(lanes);
+    }
+    return i - continuations + count_leading_bytes_scalar(data + i, length - i);
+}
+#endif
+
+#ifdef ELY_KERNELS_AVX2
+__attribute__((target("avx2")))
+static size_t find_avx2(const char* data, size_t length, const char* needle, size_t needle_length, size_t from)
+{
+    const __m256i first = _mm256_set1_epi8(needle[0]);
+    const __m256i last = _mm256_set1_epi8(needle[needle_length - 1]);
+
+    size_t i = from;
+    for (; i + needle_length - 1 + 32 <= length; i += 32) {
+        const __m256i block_first = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const __m256i block_last = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i + needle_length - 1));
+        unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(
+            _mm256_and_si256(_mm256_cmpeq_epi8(first, block_first), _mm256_cmpeq_epi8(last, block_last))));
+        for (; mask != 0; mask &= mask - 1) {
+            const size_t candidate = i + count_trailing_zeros(mask);
+            if (std::memcmp(data + candidate + 1, needle + 1, needle_length - 2) == 0)
+                return candidate;
+        }
+    }
+    return find_scalar(data, length, needle, needle_length, i);
+}
+
+__attribute__((target("avx2")))
+static size_t find_byte_avx2(const char* data, size_t length, char byte, size_t from)
+{
+    const __m256i pattern = _mm256_set1_epi8(byte);
+
+    size_t i = from;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(pattern, block)));
+        if (mask != 0)
+            return i + count_trailing_zeros(mask);
+    }
+    return i < length ? find_byte_scalar(data, length, byte, i) : std::string_view::npos;
+}
+
+__attribute__((target("avx2")))
+static size_t count_byte_avx2(const char* data, size_t length, char byte)
+{
+    const __m256i pattern = _mm256_set1_epi8(byte);
+
+    size_t count = 0;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        count += popcount(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpeq_epi8(pattern, block))));
+    }
+    return count + count_byte_scalar(data + i, length - i, byte);
+}
+
+__attribute__((target("avx2")))
+static void flip_case_avx2(char* data, size_t length, char lo, char hi)
+{
+    const __m256i shift = _mm256_set1_epi8(static_cast<char>(-128 - lo));
+    const __m256i limit = _mm256_set1_epi8(static_cast<char>(-128 + (hi - lo) + 1));
+    const __m256i bit = _mm256_set1_epi8(0x20);
+
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        __m256i* address = reinterpret_cast<__m256i*>(data + i);
+        const __m256i block = _mm256_loadu_si256(address);
+        const __m256i in_range = _mm256_cmpgt_epi8(limit, _mm256_add_epi8(block, shift));
+        _mm256_storeu_si256(address, _mm256_xor_si256(block, _mm256_and_si256(in_range, bit)));
+    }
+    flip_case_scalar(data + i, length - i, lo, hi);
+}
+
+__attribute__((target("avx2")))
+static size_t ascii_prefix_avx2(const char* data, size_t length)
+{
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        const unsigned mask = static_cast<unsigned>(_mm256_movemask_epi8(block));
+        if (mask != 0)
+            return i + count_trailing_zeros(mask);
+    }
+    return i + ascii_prefix_scalar(data + i, length - i);
+}
+
+__attribute__((target("avx2")))
+static size_t count_leading_bytes_avx2(const char* data, size_t length)
+{
+    const __m256i limit = _mm256_set1_epi8(-64);
+
+    size_t continuations = 0;
+    size_t i = 0;
+    for (; i + 32 <= length; i += 32) {
+        const __m256i block = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(data + i));
+        continuations += popcount(static_cast<unsigned>(_mm256_movemask_epi8(_mm256_cmpgt_epi8(limit, block))));
+    }
+    return i - continuations + count_leading_bytes_scalar(data + i, length - i);
+}
+#endif
+
+static KernelTable select_kernels()
+{
+    // ELY_KERNELS=scalar|sse2 forces a kernel set, to compare them.
+    const char* forced = std::getenv("ELY_KERNELS");
+    if (forced != nullptr && std::strcmp(forced, "scalar") == 0)
+        return { "scalar", find_scalar, find_byte_scalar, count_byte_scalar, flip_case_scalar,
+                 ascii_prefix_scalar, count_leading_bytes_scalar };
+#ifdef ELY_KERNELS_AVX2
+    if (__builtin_cpu_supports("avx2") && (forced == nullptr || std::strcmp(forced, "sse2") != 0))
+        return { "avx2", find_avx2, find_byte_avx2, count_byte_avx2, flip_case_avx2,
+                 ascii_prefix_avx2, count_leading_bytes_avx2 };
+#endif
+#ifdef ELY_KERNELS_SSE2
+    return { "sse2", find_sse2, find_byte_sse2, count_byte_sse2, flip_case_sse2,
+             ascii_prefix_sse2, count_leading_bytes_sse2 };
+#else
+    return { "scalar", find_scalar, find_byte_scalar, count_byte_scalar, flip_case_scalar,
+             ascii_prefix_scalar, count_leading_bytes_scalar };
+#endif
+}
+
+static const KernelTable& kernels()
+{
+    static const KernelTable table = select_kernels();
+    return table;
+}
+
+size_t find(std::string_view haystack, std::string_view needle, size_t from)
+{
+    if (from > haystack.size() || needle.size() > haystack.size() - from)
+        return std::string_view::npos;
+    if (needle.empty())
+        return from;
+    if (needle.size() == 1)
+        return kernels().find_byte(haystack.data(), haystack.size(), needle[0], from);
+    return kernels().find(haystack.data(), haystack.size(), needle.data(), needle.size(), from);
+}
+
+size_t count(std::string_view haystack, std::string_view needle)
+{
+    if (needle.empty())
+        return haystack.size() + 1;
+    if (needle.size() == 1)
+        return kernels().count_byte(haystack.data(), haystack.size(), needle[0]);
+
+    size_t count = 0;
+    for (size_t found = find(haystack, needle); found != std::string_view::npos;
+         found = find(haystack, needle, found + needle.size()))
+        ++count;
+    return count;
+}
+
+void to_upper(char* data, size_t length)
+{
+    kernels().flip_case(data, length, 'a', 'z');
+}
+
+void to_lower(char* data, size_t length)
+{
+    kernels().flip_case(data, length, 'A', 'Z');
+}
+
+size_t ascii_prefix(std::string_view text)
+{
+    return kernels().ascii_prefix(text.data(), text.size());
+}
+
+size_t count_code_points(std::string_view text)
+{
+    return kernels().count_leading_bytes(text.data(), text.size());
+}
+
+size_t sequence_length(std::string_view text, size_t offset)
+{
+    size_t end = offset + 1;
+    while (end < text.size() && (static_cast<unsigned char>(text[end]) & 0xC0) == 0x80)
+        ++end;
+    return end - offset;
+}
+
+TextEncoding classify(std::string_view text)
+{
+    const auto* bytes = reinterpret_cast<const unsigned char*>(text.data());
+    const size_t length = text.size();
+
+    size_t i = ascii_prefix(text);
+    if (i == length)
+        return TextEncoding::Ascii;
+
+    while (i < length) {
+        const unsigned char lead = bytes[i];
+        if (lead < 0x80) {
+            i += kernels().ascii_prefix(text.data() + i, length - i);
+            continue;
+        }
+
+        size_t sequence;
+        if (lead >= 0xC2 && lead <= 0xDF)
+            sequence = 2;
+        else if ((lead & 0xF0) == 0xE0)
+            sequence = 3;
+        else if (lead >= 0xF0 && lead <= 0xF4)
+            sequence = 4;
+        else
+            return TextEncoding::Invalid;
+
+        if (sequence > length - i)
+            return TextEncoding::Invalid;
+        for (size_t k = 1; k < sequence; ++k) {
+            if ((bytes[i + k] & 0xC0) != 0x80)
+                return TextEncoding::Invalid;
+        }
+
+        // Overlong forms, UTF-16 surrogates and code points past U+10FFFF.
+        const unsigned char second = bytes[i + 1];
+        if ((lead == 0xE0 && second < 0xA0) || (lead == 0xED && second > 0x9F) ||
+            (lead == 0xF0 && second < 0x90) || (lead == 0xF4 && second > 0x8F))
+            return TextEncoding::Invalid;
+
+        i += sequence;
+    }
+    return TextEncoding::Utf8;
+}
+
+const char* instruction_set()
+{
+    return kernels().name;
+}
+
+}
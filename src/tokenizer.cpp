@@ -20,35 +20,96 @@ Token Tokenizer::scan_token()
         case ')': return make_token(TokenType::CloseParen);
         case '[': return make_token(TokenType::OpenSquare);
         case ']': return make_token(TokenType::CloseSquare);
-        case '{': return make_token(TokenType::OpenCurly);
-        case '}': return make_token(TokenType::CloseCurly);
+        case '{':
+            if (!template_braces.empty()) ++template_braces.back();
+            return make_token(TokenType::OpenCurly);
+        case '}':
+            if (!template_braces.empty()) {
+                // The end of an interpolated expression resumes the template.
+                if (template_braces.back() == 0) {
+                    template_braces.pop_back();
+                    return template_();
+                }
+                --template_braces.back();
+            }
+            return make_token(TokenType::CloseCurly);
         case ';': return make_token(TokenType::Semicolon);
         case ',': return make_token(TokenType::Comma);
-        case '.': return make_token(TokenType::Dot);
-        case '-': return make_token(TokenType::Minus);
-        case '+': return make_token(TokenType::Plus);
-        case '/': return make_token(TokenType::Slash);
-        case '*': return make_token(TokenType::Star);
-        case '^': return make_token(TokenType::BwXor);
-        case '&': return make_token(match('&') ? TokenType::And : TokenType::BwAnd);
-        case '|': return make_token(match('|') ? TokenType::Or : TokenType::BwOr);
+        case ':': return make_token(TokenType::Colon);
+        case '.': return make_token(match('.') ? TokenType::DotDot : TokenType::Dot);
+        case '-':
+            return make_token(match('-') ? TokenType::MinusMinus : match('=') ?
+                              TokenType::MinusEqual : TokenType::Minus);
+        case '+':
+            return make_token(match('+') ? TokenType::PlusPlus : match('=') ?
+                              TokenType::PlusEqual : TokenType::Plus);
+        case '/': return make_token(match('=') ? TokenType::SlashEqual : TokenType::Slash);
+        case '*': return make_token(match('=') ? TokenType::StarEqual : TokenType::Star);
+        case '^': return make_token(match('=') ? TokenType::BwXorEqual : TokenType::BwXor);
+        case '&':
+            return make_token(match('&') ? TokenType::And : match('=') ?
+                              TokenType::BwAndEqual : TokenType::BwAnd);
+        case '|':
+            return make_token(match('|') ? TokenType::Or : match('=') ?
+                              TokenType::BwOrEqual : TokenType::BwOr);
         case '!':
             return make_token(match('=') ? TokenType::ExclEqual : TokenType::Excl);
         case '=':
             return make_token(match('=') ? TokenType::EqualEqual : TokenType::Equal);
         case '<':
-            return make_token(match('=') ? TokenType::LessEqual : match('<') ?
-                              TokenType::LessLess : TokenType::Less);
+            if (match('<'))
+                return make_token(match('=') ? TokenType::LessLessEqual : TokenType::LessLess);
+            return make_token(match('=') ? TokenType::LessEqual : TokenType::Less);
         case '>':
-            return make_token(match('=') ? TokenType::GreaterEqual : match('>') ?
-                              TokenType::GreaterGreater : TokenType::Greater);
+            if (match('>'))
+                return make_token(match('=') ? TokenType::GreaterGreaterEqual : TokenType::GreaterGreater);
+            return make_token(match('=') ? TokenType::GreaterEqual : TokenType::Greater);
             
         case '"': return string_();
+        case '`': return template_();
         case '\'': return string_('\'');
         default: return error_token("Unexpected character.");
     }
 }
 
+Token Tokenizer::peek_token(int skip)
+{
+    const auto saved_start = start;
+    const auto saved_current = current;
+    const int saved_line = line;
+    const std::vector<int> saved_braces = template_braces;
+
+    Token token = scan_token();
+    while (skip-- > 0 && token.get_type() != TokenType::Eof)
+        token = scan_token();
+
+    start = saved_start;
+    current = saved_current;
+    line = saved_line;
+    template_braces = saved_braces;
+    return token;
+}
+
+Token Tokenizer::skip_block()
+{
+    int depth = 1;
+    while (true) {
+        Token token = scan_token();
+        switch (token.get_type()) {
+            case TokenType::OpenCurly:
+                depth++;
+                break;
+            case TokenType::CloseCurly:
+                if (--depth == 0) return token;
+                break;
+            case TokenType::Eof:
+                return token;
+            default:
+                break;
+        }
+    }
+}
+
 bool Tokenizer::is_at_end() const
 {
     return current == source.length();
@@ -131,7 +192,17 @@ TokenType Tokenizer::check_keyword(size_t pos, size_t len, const std::string_vie
 TokenType Tokenizer::identifier_type()
 {
     switch (source[start]) {
-        case 'c': return check_keyword(1, 4, "lass", TokenType::Class);
+        case 'c':
+            if (current - start > 1) {
+                switch (source[start + 1]) {
+                    case 'a': return check_keyword(2, 2, "se", TokenType::Case);
+                    case 'l': return check_keyword(2, 3, "ass", TokenType::Class);
+                    case 'o': return check_keyword(2, 3, "nst", TokenType::Const);
+                    default: return TokenType::Identifier;
+                }
+            }
+            break;
+        case 'd': return check_keyword(1, 6, "efault", TokenType::Default);
         case 'e': return check_keyword(1, 3, "lse", TokenType::Else);
         case 'f':
             if (current - start > 1) {
@@ -143,11 +214,28 @@ TokenType Tokenizer::identifier_type()
                 }
             }
             break;
-        case 'i': return check_keyword(1, 1, "f", TokenType::If);
+        case 'i':
+            if (current - start > 1) {
+                switch (source[start + 1]) {
+                    case 'f': return check_keyword(2, 0, "", TokenType::If);
+                    case 'n': return check_keyword(2, 0, "", TokenType::In);
+                    default: return TokenType::Identifier;
+                }
+            }
+            break;
         case 'n': return check_keyword(1, 3, "ull", TokenType::Null);
         case 'p': return check_keyword(1, 4, "rint", TokenType::Print);
         case 'r': return check_keyword(1, 5, "eturn", TokenType::Return);
-        case 's': return check_keyword(1, 4, "uper", TokenType::Super);
+        case 's':
+            if (current - start > 1) {
+                switch (source[start + 1]) {
+                    case 't': return check_keyword(2, 4, "ruct", TokenType::Struct);
+                    case 'u': return check_keyword(2, 3, "per", TokenType::Super);
+                    case 'w': return check_keyword(2, 4, "itch", TokenType::Switch);
+                    default: return TokenType::Identifier;
+                }
+            }
+            break;
         case 't':
             if (current - start > 1) {
                 switch (source[start + 1]) {
@@ -184,6 +272,26 @@ Token Tokenizer::number()
     return make_token(TokenType::Number);
 }
 
+Token Tokenizer::template_()
+{
+    while (peek() != '`' && !is_at_end()) {
+        if (peek() == '$' && peek_next() == '{') {
+            advance();
+            advance();
+            template_braces.push_back(0);
+            return make_token(TokenType::TemplatePart);
+        }
+        if (peek() == '\n') line++;
+        advance();
+    }
+
+    if (is_at_end()) return error_token("Unterminated template string.");
+
+    // The closing `.
+    advance();
+    return make_token(TokenType::Template);
+}
+
 Token Tokenizer::string_(const char open_char)
 {
     while (peek() != open_char && !is_at_end()) {
@@ -0,0 +1,44 @@
+#include "runtime/typed_array.h"
+
+TypedArrayObj::TypedArrayObj(ElementKind kind, size_t size, double fill)
+{
+    switch (kind) {
+        case ElementKind::F64: elements = std::vector<double>(size, fill); break;
+        case ElementKind::I64: elements = std::vector<int64_t>(size, convert<int64_t>(fill)); break;
+        case ElementKind::I32: elements = std::vector<int32_t>(size, convert<int32_t>(fill)); break;
+        case ElementKind::U8:  elements = std::vector<uint8_t>(size, convert<uint8_t>(fill)); break;
+    }
+}
+
+std::optional<ElementKind> TypedArrayObj::parse_kind(std::string_view name)
+{
+    if (name == "f64") return ElementKind::F64;
+    if (name == "i64") return ElementKind::I64;
+    if (name == "i32") return ElementKind::I32;
+    if (name == "u8")  return ElementKind::U8;
+    return std::nullopt;
+}
+
+const char* TypedArrayObj::kind_name(ElementKind kind)
+{
+    switch (kind) {
+        case ElementKind::F64: return "f64";
+        case ElementKind::I64: return "i64";
+        case ElementKind::I32: return "i32";
+        case ElementKind::U8:  return "u8";
+    }
+    return "";
+}
+
+void OutputVisitor::operator()(const TypedArray& a) const
+{
+    const size_t size = a->size();
+    std::cout << TypedArrayObj::kind_name(a->kind()) << "[ ";
+    for (size_t i = 0; i < size; ++i) {
+        if (i < size - 1)
+            std::cout << Value(a->get(i)) << ", ";
+        else
+            std::cout << Value(a->get(i));
+    }
+    std::cout << " ]";
+}
@@ -1,4 +1,8 @@
 #include "runtime/value.h"
+#include "runtime/map.h"
+
+#include <algorithm>
+#include <cstring>
 
 void Chunk::write(uint8_t byte, int line)
 {
@@ -17,6 +21,57 @@ size_t Chunk::add_constant(Value value)
     return constants.size() - 1;
 }
 
+std::optional<size_t> Chunk::find_constant(const Value& value) const
+{
+    // Numbers are compared bitwise: 0 and -0 are different constants.
+    const double* number = std::get_if<double>(&value);
+    const std::string* str = std::get_if<std::string>(&value);
+    const bool shared = std::holds_alternative<Struct>(value) || std::holds_alternative<Func>(value);
+    if (number == nullptr && str == nullptr && !shared)
+        return std::nullopt;
+
+    for (size_t i = 0; i < constants.size(); ++i) {
+        if (shared) {
+            if (constants[i] == value)
+                return i;
+        } else if (number != nullptr) {
+            const double* other = std::get_if<double>(&constants[i]);
+            if (other != nullptr && std::memcmp(other, number, sizeof(double)) == 0)
+                return i;
+        } else if (const std::string* other = std::get_if<std::string>(&constants[i]); other != nullptr && *other == *str) {
+            return i;
+        }
+    }
+    return std::nullopt;
+}
+
+/**
+ * @brief Literal values compare equal as constants do, numbers bitwise.
+*/
+static bool same_literal(const Value& a, const Value& b)
+{
+    if (a.index() != b.index())
+        return false;
+    if (const double* number = std::get_if<double>(&a))
+        return std::memcmp(number, &std::get<double>(b), sizeof(double)) == 0;
+    if (const std::string* str = std::get_if<std::string>(&a))
+        return *str == std::get<std::string>(b);
+    if (const bool* boolean = std::get_if<bool>(&a))
+        return *boolean == std::get<bool>(b);
+    return true;
+}
+
+size_t Chunk::add_template(Array pattern)
+{
+    for (size_t i = 0; i < templates.size(); ++i) {
+        if (templates[i]->size() == pattern->size()
+            && std::equal(pattern->begin(), pattern->end(), templates[i]->begin(), same_literal))
+            return i;
+    }
+    templates.push_back(std::move(pattern));
+    return templates.size() - 1;
+}
+
 void Chunk::disassemble(const std::string& name)
 {
     fmt::print("== {} ==\n", name);
@@ -40,6 +95,15 @@ static int constant_instruction(const std::string& name, const Chunk& chunk, int
     return offset + 2;
 }
 
+static int template_instruction(const std::string& name, const Chunk& chunk, int offset)
+{
+    const int index = (chunk.get_code(offset + 1) << 8) | chunk.get_code(offset + 2);
+	fmt::print("{:<16s} {:4d} '", name, index);
+    std::cout << Value(chunk.get_template(index));
+    fmt::print("'\n");
+    return offset + 3;
+}
+
 static int invoke_instruction(const std::string& name, const Chunk& chunk, int offset)
 {
     uint8_t constant = chunk.get_code(offset + 1);
@@ -49,6 +113,14 @@ static int invoke_instruction(const std::string& name, const Chunk& chunk, int o
     return offset + 3;
 }
 
+static int field_instruction(const std::string& name, const Chunk& chunk, int offset)
+{
+    const Struct& type = std::get<Struct>(chunk.get_constant(chunk.get_code(offset + 1)));
+    uint8_t field = chunk.get_code(offset + 2);
+    fmt::print("{:<16s} {:4d} '{}.{}'\n", name, field, type->name, type->fields[field]);
+    return offset + 3;
+}
+
 static int byte_instruction(const std::string& name, const Chunk& chunk, int offset)
 {
     uint8_t slot = chunk.get_code(offset + 1);
@@ -56,6 +128,73 @@ static int byte_instruction(const std::string& name, const Chunk& chunk, int off
     return offset + 2;
 }
 
+static int compound_instruction(const std::string& name, bool has_operand, const Chunk& chunk, int offset)
+{
+    const uint8_t mode = chunk.get_code(offset + (has_operand ? 2 : 1));
+    const char* postfix = (mode & COMPOUND_POSTFIX) != 0 ? " postfix" : "";
+    if (has_operand) {
+        fmt::print("{:<16s} {:4d} op {}{}\n", name, chunk.get_code(offset + 1),
+                   mode & ~COMPOUND_POSTFIX, postfix);
+        return offset + 3;
+    }
+    fmt::print("{:<16s} op {}{}\n", name, mode & ~COMPOUND_POSTFIX, postfix);
+    return offset + 2;
+}
+
+static int inline_instruction(const std::string& name, bool has_method, const Chunk& chunk, int offset)
+{
+    const int operands = offset + (has_method ? 2 : 1);
+    const Func& function = std::get<Func>(chunk.get_constant(chunk.get_code(operands + 1)));
+    const int skip = (chunk.get_code(operands + 2) << 8) | chunk.get_code(operands + 3);
+    if (has_method) {
+        fmt::print("{:<16s} {:4d} '{}' ", name, chunk.get_code(offset + 1),
+                   std::get<std::string>(chunk.get_constant(chunk.get_code(offset + 1))));
+    } else {
+        fmt::print("{:<16s} ", name);
+    }
+    fmt::print("({} args) <fn {}> else -> {}\n", chunk.get_code(operands), function->get_name(), operands + 4 + skip);
+    return operands + 4;
+}
+
+static int jump_table_instruction(const std::string& name, const Chunk& chunk, int offset)
+{
+    const double low = std::get<double>(chunk.get_constant(chunk.get_code(offset + 1)));
+    const int size = (chunk.get_code(offset + 2) << 8) | chunk.get_code(offset + 3);
+    const int end = offset + 6 + 2 * size;
+    auto target = [&](int at) { return end - ((chunk.get_code(at) << 8) | chunk.get_code(at + 1)); };
+
+    fmt::print("{:<16s} {:4d} default -> {}\n", name, offset, target(offset + 4));
+    for (int i = 0; i < size; ++i) {
+        fmt::print("{:04d}      |                     {} -> {}\n", offset + 6 + 2 * i, low + i, target(offset + 6 + 2 * i));
+    }
+    return end;
+}
+
+static int switch_map_instruction(const std::string& name, const Chunk& chunk, int offset)
+{
+    const Map& table = std::get<Map>(chunk.get_constant(chunk.get_code(offset + 1)));
+    const int end = offset + 4;
+    const int fallback = (chunk.get_code(offset + 2) << 8) | chunk.get_code(offset + 3);
+    fmt::print("{:<16s} {:4d} default -> {}\n", name, offset, end - fallback);
+
+    size_t position = 0;
+    while (const MapObj::Entry* entry = table->next(position)) {
+        fmt::print("{:04d}      |                     ", offset);
+        std::cout << entry->key;
+        fmt::print(" -> {}\n", end - static_cast<int>(std::get<double>(entry->value)));
+    }
+    return end;
+}
+
+static int for_instruction(const std::string& name, int sign, const Chunk& chunk, int offset)
+{
+    uint8_t slot = chunk.get_code(offset + 1);
+    uint16_t jump = static_cast<uint16_t>(chunk.get_code(offset + 2) << 8);
+    jump |= static_cast<uint16_t>(chunk.get_code(offset + 3));
+    fmt::print("{:<16s} {:4d} {:4d} -> {}\n", name, slot, offset, offset + 4 + sign * jump);
+    return offset + 4;
+}
+
 static int jmp_instruction(const std::string& name, int sign, const Chunk& chunk, int offset)
 {
     uint16_t jump = static_cast<uint16_t>(chunk.get_code(offset + 1) << 8);
@@ -154,10 +293,12 @@ int Chunk::disas_instruction(int offset)
             
             Func function = std::get<Func>(constants[constant]);
             for (int j = 0; j < function->upvalue_count; j++) {
-                int is_local = code[offset++];
+                CaptureKind kind = CaptureKind(code[offset++]);
                 int index = code[offset++];
+                const char* kind_name = kind == CaptureKind::Upvalue ? "upvalue"
+                                      : kind == CaptureKind::Boxed ? "local" : "value";
                 fmt::print("{:04d}      |                     {} {}\n",
-                    offset - 2, is_local ? "local" : "upvalue", index);
+                    offset - 2, kind_name, index);
             }
             
             return offset;
@@ -173,7 +314,7 @@ int Chunk::disas_instruction(int offset)
         case Opcode::Method:
             return constant_instruction("OP_METHOD", *this, offset);
         case Opcode::ArrBuild:
-            return constant_instruction("ARR_BUILD", *this, offset);
+            return byte_instruction("ARR_BUILD", *this, offset);
         case Opcode::ArrIndex:
             return simple_instruction("ARR_INDEX", offset);
         case Opcode::ArrStore:
@@ -182,8 +323,107 @@ int Chunk::disas_instruction(int offset)
             return simple_instruction("SHIFT_LEFT", offset);
         case Opcode::ShiftRight:
             return simple_instruction("SHIFT_RIGHT", offset);;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;;
+        case Opcode::MapBuild:
+            return byte_instruction("MAP_BUILD", *this, offset);
+        case Opcode::ArrClone:
+            return template_instruction("ARR_CLONE", *this, offset);
+        case Opcode::ArrExtend:
+            return template_instruction("ARR_EXTEND", *this, offset);
+        case Opcode::ArrAppend:
+            return byte_instruction("ARR_APPEND", *this, offset);
+        case Opcode::GetField:
+            return field_instruction("GET_FIELD", *this, offset);
+        case Opcode::SetField:
+            return field_instruction("SET_FIELD", *this, offset);
+        case Opcode::ForPrep:
+            return for_instruction("FOR_PREP", 1, *this, offset);
+        case Opcode::ForLoop:
+            return for_instruction("FOR_LOOP", -1, *this, offset);
+        case Opcode::IterNext:
+            return for_instruction("ITER_NEXT", -1, *this, offset);
+        case Opcode::NotEqual:
+            return simple_instruction("OP_NOT_EQUAL", offset);
+        case Opcode::GreaterEqual:
+            return simple_instruction("OP_GREATER_EQUAL", offset);
+        case Opcode::LessEqual:
+            return simple_instruction("OP_LESS_EQUAL", offset);
+        case Opcode::JumpIfNotEqual:
+            return jmp_instruction("OP_JUMP_IF_NOT_EQUAL", 1, *this, offset);
+        case Opcode::JumpIfEqual:
+            return jmp_instruction("OP_JUMP_IF_EQUAL", 1, *this, offset);
+        case Opcode::JumpIfNotGreater:
+            return jmp_instruction("OP_JUMP_IF_NOT_GREATER", 1, *this, offset);
+        case Opcode::JumpIfNotGreaterEqual:
+            return jmp_instruction("OP_JUMP_IF_NOT_GREATER_EQUAL", 1, *this, offset);
+        case Opcode::JumpIfNotLess:
+            return jmp_instruction("OP_JUMP_IF_NOT_LESS", 1, *this, offset);
+        case Opcode::JumpIfNotLessEqual:
+            return jmp_instruction("OP_JUMP_IF_NOT_LESS_EQUAL", 1, *this, offset);
+        case Opcode::CompoundLocal:
+            return compound_instruction("OP_COMPOUND_LOCAL", true, *this, offset);
+        case Opcode::CompoundUpvalue:
+            return compound_instruction("OP_COMPOUND_UPVALUE", true, *this, offset);
+        case Opcode::CompoundGlobal:
+            return compound_instruction("OP_COMPOUND_GLOBAL", true, *this, offset);
+        case Opcode::CompoundProperty:
+            return compound_instruction("OP_COMPOUND_PROPERTY", true, *this, offset);
+        case Opcode::CompoundIndex:
+            return compound_instruction("OP_COMPOUND_INDEX", false, *this, offset);
+        case Opcode::JumpTable:
+            return jump_table_instruction("OP_JUMP_TABLE", *this, offset);
+        case Opcode::SwitchMap:
+            return switch_map_instruction("OP_SWITCH_MAP", *this, offset);
+        case Opcode::Interpolate:
+            return byte_instruction("OP_INTERPOLATE", *this, offset);
+        case Opcode::ReturnValues:
+            return byte_instruction("OP_RETURN_VALUES", *this, offset);
+        case Opcode::Unpack:
+            return byte_instruction("OP_UNPACK", *this, offset);
+        case Opcode::InlineCall:
+            return inline_instruction("OP_INLINE_CALL", false, *this, offset);
+        case Opcode::InlineInvoke:
+            return inline_instruction("OP_INLINE_INVOKE", true, *this, offset);
+        case Opcode::GetSlot:
+            return byte_instruction("OP_GET_SLOT", *this, offset);
+        case Opcode::SetSlot:
+            return byte_instruction("OP_SET_SLOT", *this, offset);
+        case Opcode::InlineEnd:
+            return byte_instruction("OP_INLINE_END", *this, offset);
     }
     
 	fmt::print("Uknown opcode: {}\n", code[offset]);
     return offset + 1;
 }
+
+Array ArrayObj::slice(const Array& array, size_t begin, size_t end)
+{
+    const size_t size = array->size();
+    end = std::min(end, size);
+    begin = std::min(begin, end);
+
+    const Array& parent = array->is_view() ? array->parent : array;
+    return Array(new ArrayObj(parent, array->offset + begin, end - begin));
+}
+
+Array ArrayObj::copy(const Array& array)
+{
+    if (array->is_view())
+        return std::make_shared<ArrayObj>(Storage(array->begin(), array->end()));
+
+    Array result = std::make_shared<ArrayObj>();
+    result->storage = array->storage;
+    return result;
+}
+
+ArrayObj::Storage& ArrayObj::resizable()
+{
+    if (parent != nullptr) {
+        storage = std::make_shared<Storage>(begin(), end());
+        parent.reset();
+        offset = 0;
+        length = 0;
+    } else if (storage.use_count() > 1) {
+        storage = std::make_shared<Storage>(*storage);
+    }
+    return *storage;
+}